@@ -0,0 +1,111 @@
+// Worker affinity benchmark: the same download load against an unpinned server and a server with one pinned
+// shard per CPU (requests steered to the shard of the CPU that received them).
+//
+// The gain comes from keeping the packets of a session on one core (and its buffers on one NUMA node): expect
+// it on multi-socket machines with a multi-queue NIC, run the clients on another host for meaningful numbers.
+
+#include <cstring>
+
+#include "tftp/client.h"
+#include "tftp/log.h"
+#include "tftp/server.h"
+#include "tftp/OS/Thread.h"
+
+#include "common.h"
+
+namespace
+{
+    void usage()
+    {
+        printf("Usage: tftp_bench_affinity [--cpus l] [--clients n] [--transfers n] [--filesize bytes] [--port p]\n"
+               "  cpus: comma separated list of CPUs of the pinned server, defaults to all allowed CPUs\n");
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> cpus = tftp::allowedCpus();
+    int clients = 32;
+    int transfers = 256;
+    int64_t file_size = 4 * 1024 * 1024;
+    char const* port = "16970";
+
+    bool is_valid = bench::parseOptions(argc, argv, [&](char const* arg, char const* value)
+    {
+        if (strcmp(arg, "--cpus") == 0)
+        {
+            auto list = bench::parseList(value);
+            cpus.assign(list.begin(), list.end());
+        }
+        else if (strcmp(arg, "--clients")   == 0) { clients   = atoi(value);  }
+        else if (strcmp(arg, "--transfers") == 0) { transfers = atoi(value);  }
+        else if (strcmp(arg, "--filesize")  == 0) { file_size = atoll(value); }
+        else if (strcmp(arg, "--port")      == 0) { port      = value;        }
+        else
+        {
+            return false;
+        }
+        return true;
+    });
+    if (not is_valid)
+    {
+        usage();
+        return -1;
+    }
+
+    // Per session logs would flood the report
+    tftp::log::setLevel(tftp::LogLevel::WARNING);
+
+    bench::ScratchDirectory workdir("tftp_bench_affinity");
+    bench::createFile("file", file_size);
+
+    printf("%zu CPUs, %d clients, %d transfers of %ld bytes\n", cpus.size(), clients, transfers, file_size);
+    printf("%-10s %-8s %-10s %-14s %-10s %s\n", "server", "shards", "MB/s", "cpu (s/GB)", "failed", "remote sessions");
+
+    for (bool pinned : { false, true })
+    {
+        tftp::ServerConfig server_config;
+        server_config.address = "::1";
+        server_config.port = port;
+        server_config.max_sessions = clients;
+        server_config.max_pending = clients * 4;
+        if (pinned)
+        {
+            server_config.cpus = cpus;
+        }
+
+        tftp::Server server(server_config);
+        if (server.start())
+        {
+            fprintf(stderr, "cannot start the server on port %s\n", port);
+            return -1;
+        }
+
+        tftp::ClientConfig config;
+        config.server = "::1";
+        config.port = atoi(port);
+        config.max_concurrency = clients;
+        config.timeout = std::chrono::milliseconds(1000);
+
+        std::vector<tftp::Job> jobs;
+        for (int i = 0; i < transfers; ++i)
+        {
+            jobs.push_back({tftp::opcode::RRQ, "file", "out/" + std::to_string(i % clients)});
+        }
+
+        tftp::Client client(config);
+        double cpu_begin = bench::cpuSeconds();
+        tftp::BatchResult result = client.run(jobs);
+        double cpu = bench::cpuSeconds() - cpu_begin;
+
+        tftp::ServerStats stats = server.stats();
+        server.stop();
+
+        double gb = result.bytes / 1024.0 / 1024.0 / 1024.0;
+        printf("%-10s %-8zu %-10.2f %-14.3f %-10d %lu\n", pinned ? "pinned" : "unpinned", pinned ? cpus.size() : 1,
+               result.throughput() / 1024.0 / 1024.0, (gb > 0) ? cpu / gb : 0.0, result.failed, stats.remote_sessions);
+    }
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+// End-to-end throughput benchmark: server engine and clients run in-process over loopback.
+//
+// Sweep blksize x windowsize x file size x concurrent clients and report, for each point, MB/s, packets per
+// second (as counted by the server), CPU time (server and clients) and transfer latency percentiles as JSON.
+// Run it with --digest to see the cost of the inline integrity check on both ends.
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "tftp/client.h"
+#include "tftp/log.h"
+#include "tftp/server.h"
+
+#include "common.h"
+
+namespace
+{
+    struct Options
+    {
+        std::vector<int64_t> block_sizes  { 512, 1428, 8192, 65464 };
+        std::vector<int64_t> window_sizes { 1, 8, 32, 64 };
+        std::vector<int64_t> file_sizes   { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+        std::vector<int64_t> clients      { 1, 8 };
+        int transfers{16};              //< transfers per point (at least one per client)
+        tftp::DigestType digest{tftp::DigestType::NONE};    //< computed by the server and the clients
+        char const* port{"16969"};
+        std::string output{"tftp_bench.json"};   //< "-" for stdout
+    };
+
+    // Run the sweep against an in-process server, one JSON object per point
+    int run(Options const& options, std::stringstream& json)
+    {
+        tftp::ServerConfig server_config;
+        server_config.address = "::1";
+        server_config.port = options.port;
+        server_config.max_sessions = static_cast<int>(*std::max_element(options.clients.begin(), options.clients.end()));
+        server_config.max_pending = server_config.max_sessions * 4;
+        server_config.digest = options.digest;
+
+        tftp::Server server(server_config);
+        if (server.start())
+        {
+            fprintf(stderr, "cannot start the server on port %s\n", options.port);
+            return -1;
+        }
+
+        json << "{\n  \"results\": [";
+        char const* separator = "\n";
+
+        for (auto file_size : options.file_sizes)
+        {
+            for (auto block_size : options.block_sizes)
+            {
+                for (auto window_size : options.window_sizes)
+                {
+                    for (auto clients : options.clients)
+                    {
+                        tftp::ClientConfig config;
+                        config.server = "::1";
+                        config.port = atoi(options.port);
+                        config.max_concurrency = static_cast<int>(clients);
+                        config.block_size = block_size;
+                        config.window_size = window_size;
+                        config.timeout = std::chrono::milliseconds(1000);
+                        config.digest = options.digest;
+
+                        std::vector<tftp::Job> jobs;
+                        int transfers = std::max<int>(options.transfers, static_cast<int>(clients));
+                        for (int i = 0; i < transfers; ++i)
+                        {
+                            jobs.push_back({tftp::opcode::RRQ, "file_" + std::to_string(file_size),
+                                            "out/" + std::to_string(i)});
+                        }
+
+                        tftp::Client client(config);
+                        tftp::Counters counters_begin = server.metrics();
+                        double cpu_begin = bench::cpuSeconds();
+                        tftp::BatchResult result = client.run(jobs);
+                        double cpu = bench::cpuSeconds() - cpu_begin;
+                        tftp::Counters counters = server.metrics();
+
+                        std::vector<double> latencies;
+                        for (auto const& job : result.jobs)
+                        {
+                            if (job.error == 0)
+                            {
+                                latencies.push_back(job.seconds);
+                            }
+                        }
+
+                        // Packets sent and received by the server during the point (retransmissions included)
+                        uint64_t packets = (counters[tftp::PACKETS_SENT] - counters_begin[tftp::PACKETS_SENT])
+                                         + (counters[tftp::PACKETS_RECEIVED] - counters_begin[tftp::PACKETS_RECEIVED]);
+
+                        double mbps = result.throughput() / 1024.0 / 1024.0;
+                        double pps = (result.seconds > 0) ? packets / result.seconds : 0;
+
+                        json << separator
+                             << "    { \"blksize\": " << block_size
+                             << ", \"windowsize\": " << window_size
+                             << ", \"file_size\": " << file_size
+                             << ", \"clients\": " << clients
+                             << ", \"digest\": \"" << tftp::toString(options.digest) << "\""
+                             << ", \"transfers\": " << transfers
+                             << ", \"failed\": " << result.failed
+                             << ", \"seconds\": " << result.seconds
+                             << ", \"mb_per_s\": " << mbps
+                             << ", \"packets_per_s\": " << pps
+                             << ", \"cpu_seconds\": " << cpu
+                             << ", \"latency_p50_s\": " << bench::percentile(latencies, 0.50)
+                             << ", \"latency_p99_s\": " << bench::percentile(latencies, 0.99)
+                             << " }";
+                        separator = ",\n";
+
+                        fprintf(stderr, "size %-9ld blksize %-6ld window %-3ld clients %-3ld: %9.2f MB/s %10.0f pkt/s "
+                                "cpu %.3fs p50 %.4fs p99 %.4fs failed %d\n",
+                                file_size, block_size, window_size, clients, mbps, pps, cpu,
+                                bench::percentile(latencies, 0.50), bench::percentile(latencies, 0.99), result.failed);
+                    }
+                }
+            }
+        }
+        json << "\n  ]\n}\n";
+
+        server.stop();
+        return 0;
+    }
+
+
+    void usage()
+    {
+        printf("Usage: tftp_bench [--blksize l] [--windowsize l] [--filesize l] [--clients l] [--transfers n] "
+               "[--digest none|crc32c|sha256] [--port p] [--output file]\n"
+               "  l: comma separated list of values, output defaults to tftp_bench.json (- for stdout)\n");
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    bool is_valid = bench::parseOptions(argc, argv, [&](char const* arg, char const* value)
+    {
+        if      (strcmp(arg, "--blksize")    == 0) { options.block_sizes  = bench::parseList(value); }
+        else if (strcmp(arg, "--windowsize") == 0) { options.window_sizes = bench::parseList(value); }
+        else if (strcmp(arg, "--filesize")   == 0) { options.file_sizes   = bench::parseList(value); }
+        else if (strcmp(arg, "--clients")    == 0) { options.clients      = bench::parseList(value); }
+        else if (strcmp(arg, "--transfers")  == 0) { options.transfers    = atoi(value);             }
+        else if (strcmp(arg, "--port")       == 0) { options.port         = value;                   }
+        else if (strcmp(arg, "--digest")     == 0)
+        {
+            if      (strcmp(value, "crc32c") == 0) { options.digest = tftp::DigestType::CRC32C; }
+            else if (strcmp(value, "sha256") == 0) { options.digest = tftp::DigestType::SHA256; }
+            else if (strcmp(value, "none")   != 0) { return false; }
+        }
+        else if (strcmp(arg, "--output")     == 0) { options.output       = value;                   }
+        else
+        {
+            return false;
+        }
+        return true;
+    });
+    if (not is_valid)
+    {
+        usage();
+        return -1;
+    }
+
+    // Per session logs would flood the report
+    tftp::log::setLevel(tftp::LogLevel::WARNING);
+
+    std::stringstream json;
+    {
+        bench::ScratchDirectory workdir("tftp_bench");
+        for (auto size : options.file_sizes)
+        {
+            bench::createFile("file_" + std::to_string(size), size);
+        }
+        if (run(options, json) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (options.output == "-")
+    {
+        fputs(json.str().c_str(), stdout);
+    }
+    else
+    {
+        std::ofstream(options.output) << json.str();
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+// Busy-poll benchmark: per-file latency of small sequential RRQs with blocking receives and with spin-then-block
+// receives on both sides.
+//
+// Spinning only pays when each side has a core for itself: on a machine with less cores than spinning threads,
+// the spin steals the CPU from the peer and the latency gets worse.
+
+#include <unistd.h>
+
+#include <cstring>
+
+#include "tftp/client.h"
+#include "tftp/log.h"
+#include "tftp/server.h"
+
+#include "common.h"
+
+namespace
+{
+    void usage()
+    {
+        printf("Usage: tftp_bench_busypoll [--budget l] [--filesize l] [--transfers n] [--port p]\n"
+               "  l: comma separated list of values, budgets in microseconds (0: blocking)\n");
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<int64_t> budgets    { 0, 20, 200 };
+    std::vector<int64_t> file_sizes { 512, 4096, 32768 };
+    int transfers = 200;
+    char const* port = "16971";
+
+    bool is_valid = bench::parseOptions(argc, argv, [&](char const* arg, char const* value)
+    {
+        if      (strcmp(arg, "--budget")    == 0) { budgets    = bench::parseList(value); }
+        else if (strcmp(arg, "--filesize")  == 0) { file_sizes = bench::parseList(value); }
+        else if (strcmp(arg, "--transfers") == 0) { transfers  = atoi(value);             }
+        else if (strcmp(arg, "--port")      == 0) { port       = value;                   }
+        else
+        {
+            return false;
+        }
+        return true;
+    });
+    if (not is_valid)
+    {
+        usage();
+        return -1;
+    }
+
+    // Per session logs would flood the report
+    tftp::log::setLevel(tftp::LogLevel::WARNING);
+
+    bench::ScratchDirectory workdir("tftp_bench_busypoll");
+    for (auto size : file_sizes)
+    {
+        bench::createFile("file_" + std::to_string(size), size);
+    }
+
+    printf("%ld CPUs online, %d sequential transfers per point\n", sysconf(_SC_NPROCESSORS_ONLN), transfers);
+    printf("%-10s %-12s %-12s %-12s %-12s %s\n", "size", "budget (us)", "p50 (us)", "p99 (us)", "cpu/file (us)", "failed");
+
+    for (auto budget : budgets)
+    {
+        tftp::ServerConfig server_config;
+        server_config.address = "::1";
+        server_config.port = port;
+        server_config.max_sessions = 1;
+        server_config.busy_poll = std::chrono::microseconds(budget);
+
+        tftp::Server server(server_config);
+        if (server.start())
+        {
+            fprintf(stderr, "cannot start the server on port %s\n", port);
+            return -1;
+        }
+
+        for (auto size : file_sizes)
+        {
+            tftp::ClientConfig config;
+            config.server = "::1";
+            config.port = atoi(port);
+            config.max_concurrency = 1;
+            config.busy_poll = std::chrono::microseconds(budget);
+
+            std::vector<tftp::Job> jobs;
+            for (int i = 0; i < transfers; ++i)
+            {
+                jobs.push_back({tftp::opcode::RRQ, "file_" + std::to_string(size), "out/file"});
+            }
+
+            tftp::Client client(config);
+            double cpu_begin = bench::cpuSeconds();
+            tftp::BatchResult result = client.run(jobs);
+            double cpu = bench::cpuSeconds() - cpu_begin;
+
+            std::vector<double> latencies;
+            for (auto const& job : result.jobs)
+            {
+                if (job.error == 0)
+                {
+                    latencies.push_back(job.seconds * 1e6);
+                }
+            }
+
+            printf("%-10ld %-12ld %-12.1f %-12.1f %-12.1f %d\n", size, budget,
+                   bench::percentile(latencies, 0.50), bench::percentile(latencies, 0.99), cpu * 1e6 / transfers, result.failed);
+        }
+
+        server.stop();
+    }
+
+    return 0;
+}
@@ -0,0 +1,385 @@
+// Microbenchmarks of the packet codec (src/protocol.cc): time and heap allocations per packet, and cost of the
+// inline digests (src/digest.cc) per block.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+#include "tftp/digest.h"
+#include "tftp/protocol.h"
+
+namespace
+{
+    std::atomic<uint64_t> allocations{0};
+
+    // Report allocations per packet of the benchmark loop (allocation count since begin)
+    void reportAllocations(benchmark::State& state, uint64_t begin)
+    {
+        state.counters["allocs/packet"] = benchmark::Counter(static_cast<double>(allocations - begin),
+                                                             benchmark::Counter::kAvgIterations);
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    std::vector<char> requestPacket(std::vector<std::pair<char const*, char const*>> const& options)
+    {
+        std::vector<char> packet;
+        packet.reserve(512); // a request fits in a default block
+        tftp::insert(packet, tftp::hton(static_cast<uint16_t>(tftp::opcode::RRQ)));
+        tftp::insert(packet, std::string("pxelinux.cfg/01-aa-bb-cc-dd-ee-ff"));
+        tftp::insert(packet, "octet");
+        for (auto const& option : options)
+        {
+            tftp::insert(packet, option.first);
+            tftp::insert(packet, option.second);
+        }
+        return packet;
+    }
+}
+
+
+// Count every heap allocation of the process. All the forms of new end up in malloc, all the forms of delete in
+// free: GCC sees the malloc/free calls of the replacements and reports every delete as mismatched.
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace
+{
+    void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) noexcept
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        void* ptr = nullptr;
+        if (alignment <= alignof(std::max_align_t))
+        {
+            ptr = std::malloc(size == 0 ? 1 : size);
+        }
+        else if (posix_memalign(&ptr, alignment, size == 0 ? 1 : size) != 0)
+        {
+            ptr = nullptr;
+        }
+        return ptr;
+    }
+
+    void* allocateOrThrow(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+    {
+        void* ptr = allocate(size, alignment);
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+}
+
+void* operator new(std::size_t size)                                                { return allocateOrThrow(size); }
+void* operator new[](std::size_t size)                                              { return allocateOrThrow(size); }
+void* operator new(std::size_t size, std::align_val_t al)                           { return allocateOrThrow(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al)                         { return allocateOrThrow(size, static_cast<std::size_t>(al)); }
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept                { return allocate(size); }
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept              { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t al, std::nothrow_t const&) noexcept   { return allocate(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al, std::nothrow_t const&) noexcept { return allocate(size, static_cast<std::size_t>(al)); }
+
+void operator delete(void* ptr) noexcept                                            { std::free(ptr); }
+void operator delete[](void* ptr) noexcept                                          { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept                               { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept                             { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept                          { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept                        { std::free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept             { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept           { std::free(ptr); }
+void operator delete(void* ptr, std::nothrow_t const&) noexcept                     { std::free(ptr); }
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept                   { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t, std::nothrow_t const&) noexcept   { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, std::nothrow_t const&) noexcept { std::free(ptr); }
+
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+#pragma GCC diagnostic pop
+#endif
+
+
+static void BM_hton16(benchmark::State& state)
+{
+    uint16_t value = 0x1234;
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        value = tftp::hton(value);
+        benchmark::DoNotOptimize(value);
+    }
+    reportAllocations(state, begin);
+}
+BENCHMARK(BM_hton16);
+
+
+static void BM_hton32(benchmark::State& state)
+{
+    uint32_t value = 0x12345678;
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        value = tftp::hton(value);
+        benchmark::DoNotOptimize(value);
+    }
+    reportAllocations(state, begin);
+}
+BENCHMARK(BM_hton32);
+
+
+class RequestFixture : public benchmark::Fixture
+{
+public:
+    void SetUp(benchmark::State const&) override
+    {
+        simple = requestPacket({});
+
+        // What PXE firmwares and our client send, with options the server does not support in the middle
+        options = requestPacket({ {"blksize", "1428"}, {"rollover", "0"}, {"tsize", "0"},
+                                  {"timeout", "3"}, {"multicast", ""}, {"windowsize", "64"} });
+
+        mixed_case = requestPacket({ {"BlkSize", "1428"}, {"TSIZE", "0"}, {"WindowSize", "64"} });
+    }
+
+    std::vector<char> simple;
+    std::vector<char> options;
+    std::vector<char> mixed_case;
+};
+
+BENCHMARK_F(RequestFixture, parseRequest_simple)(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        tftp::Request request;
+        benchmark::DoNotOptimize(tftp::parseRequest(simple.data(), simple.size(), request));
+    }
+    reportAllocations(state, begin);
+}
+
+BENCHMARK_F(RequestFixture, parseRequest_options)(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        tftp::Request request;
+        benchmark::DoNotOptimize(tftp::parseRequest(options.data(), options.size(), request));
+    }
+    reportAllocations(state, begin);
+}
+
+BENCHMARK_F(RequestFixture, parseRequest_mixedCase)(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        tftp::Request request;
+        benchmark::DoNotOptimize(tftp::parseRequest(mixed_case.data(), mixed_case.size(), request));
+    }
+    reportAllocations(state, begin);
+}
+
+BENCHMARK_F(RequestFixture, extractOption)(benchmark::State& state)
+{
+    // First option of the option-heavy request (after opcode, filename and mode)
+    tftp::Request request;
+    char const* first_option = options.data() + 2;
+    first_option += tftp::entryLen(options.data(), options.size(), first_option);
+    first_option += tftp::entryLen(options.data(), options.size(), first_option);
+
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        char const* position = first_option;
+        benchmark::DoNotOptimize(tftp::extractOption(options.data(), options.size(), request, position));
+    }
+    reportAllocations(state, begin);
+}
+
+BENCHMARK_F(RequestFixture, forgeRequest)(benchmark::State& state)
+{
+    tftp::Request request;
+    tftp::parseRequest(options.data(), options.size(), request);
+
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(tftp::forgeRequest(request));
+    }
+    reportAllocations(state, begin);
+}
+
+
+class OptionAckFixture : public benchmark::Fixture
+{
+public:
+    void SetUp(benchmark::State const&) override
+    {
+        request.block_size.value = 1428;
+        request.block_size.is_enable = true;
+        request.window_size.value = 64;
+        request.window_size.is_enable = true;
+        request.transfer_size.value = 36 * 1024 * 1024;
+        request.transfer_size.is_enable = true;
+        packet = tftp::forgeOptionAck(request);
+    }
+
+    tftp::Request request;
+    std::vector<char> packet;
+};
+
+BENCHMARK_F(OptionAckFixture, forgeOptionAck)(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(tftp::forgeOptionAck(request));
+    }
+    reportAllocations(state, begin);
+}
+
+BENCHMARK_F(OptionAckFixture, parseOptionAck)(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        tftp::Request answer;
+        benchmark::DoNotOptimize(tftp::parseOptionAck(packet.data(), packet.size(), answer));
+    }
+    reportAllocations(state, begin);
+}
+
+
+class DataFixture : public benchmark::Fixture
+{
+public:
+    void SetUp(benchmark::State const& state) override
+    {
+        request.block_size.value = state.range(0);
+        content.assign(request.block_size.value * BLOCKS, 'x');
+        input.str(content);
+        packet.assign(request.block_size.value + 4, 'x');
+        packet[0] = 0;
+        packet[1] = tftp::opcode::DATA;
+    }
+
+    static constexpr int BLOCKS = 64;
+    tftp::Request request;
+    std::string content;
+    std::istringstream input;
+    std::vector<char> packet;
+};
+
+BENCHMARK_DEFINE_F(DataFixture, forgeData)(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    int block = 0;
+    for (auto _ : state)
+    {
+        // Rewind the source from time to time (out of the typical per packet work)
+        if ((block % BLOCKS) == 0)
+        {
+            input.clear();
+            input.seekg(0);
+        }
+        benchmark::DoNotOptimize(tftp::forgeData(request, ++block, input));
+    }
+    reportAllocations(state, begin);
+    state.SetBytesProcessed(state.iterations() * request.block_size.value);
+}
+BENCHMARK_REGISTER_F(DataFixture, forgeData)->Arg(512)->Arg(1428)->Arg(8192)->Arg(tftp::BLKSIZE.max);
+
+BENCHMARK_DEFINE_F(DataFixture, parseData)(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(tftp::parseData(packet.data(), packet.size()));
+    }
+    reportAllocations(state, begin);
+}
+BENCHMARK_REGISTER_F(DataFixture, parseData)->Arg(512)->Arg(tftp::BLKSIZE.max);
+
+
+static void BM_forgeAck(benchmark::State& state)
+{
+    int block = 0;
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(tftp::forgeAck(++block));
+    }
+    reportAllocations(state, begin);
+}
+BENCHMARK(BM_forgeAck);
+
+
+static void BM_parseAck(benchmark::State& state)
+{
+    std::vector<char> packet = tftp::forgeAck(4242);
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(tftp::parseAck(packet.data(), packet.size()));
+    }
+    reportAllocations(state, begin);
+}
+BENCHMARK(BM_parseAck);
+
+
+static void BM_getOpcode(benchmark::State& state)
+{
+    std::vector<char> packet = tftp::forgeAck(4242);
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(tftp::getOpcode(packet.data(), packet.size()));
+    }
+    reportAllocations(state, begin);
+}
+BENCHMARK(BM_getOpcode);
+
+
+static void BM_forgeError(benchmark::State& state)
+{
+    uint64_t begin = allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(tftp::forgeError(tftp::error_code::FILE_NOT_FOUND));
+    }
+    reportAllocations(state, begin);
+}
+BENCHMARK(BM_forgeError);
+
+
+// Digest update over one block of payload, hardware path (0) or portable fallback (1)
+template<tftp::DigestType TYPE>
+static void BM_digest(benchmark::State& state)
+{
+    bool allow_hardware = (state.range(1) == 0);
+    if (allow_hardware and not tftp::Digest::hasHardwareSupport(TYPE))
+    {
+        state.SkipWithError("no hardware support");
+        return;
+    }
+
+    std::vector<char> block(state.range(0), 'x');
+    tftp::Digest digest(TYPE, allow_hardware);
+    for (auto _ : state)
+    {
+        digest.update(block.data(), block.size());
+    }
+    benchmark::DoNotOptimize(digest.hex());
+    state.SetBytesProcessed(state.iterations() * block.size());
+}
+BENCHMARK_TEMPLATE(BM_digest, tftp::DigestType::CRC32C)->ArgNames({"blksize", "soft"})
+    ->ArgsProduct({{512, 1428, tftp::BLKSIZE.max}, {0, 1}});
+BENCHMARK_TEMPLATE(BM_digest, tftp::DigestType::SHA256)->ArgNames({"blksize", "soft"})
+    ->ArgsProduct({{512, 1428, tftp::BLKSIZE.max}, {0, 1}});
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,119 @@
+#ifndef TFTP_BENCH_COMMON_H
+#define TFTP_BENCH_COMMON_H
+
+// Helpers shared by the benchmark and load tools of bench/
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    // User + system CPU time of the process (server and clients when they run in-process)
+    inline double cpuSeconds()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+             + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    }
+
+    inline std::vector<std::string> split(char const* arg)
+    {
+        std::vector<std::string> items;
+        std::stringstream ss(arg);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            items.push_back(item);
+        }
+        return items;
+    }
+
+    // Comma separated list of integers
+    inline std::vector<int64_t> parseList(char const* arg)
+    {
+        std::vector<int64_t> values;
+        for (auto const& item : split(arg))
+        {
+            values.push_back(std::stoll(item));
+        }
+        return values;
+    }
+
+    // Nearest-rank percentile, p in [0, 1]
+    inline double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+        {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        size_t index = static_cast<size_t>(std::ceil(p * values.size())) - 1;
+        return values[std::min(index, values.size() - 1)];
+    }
+
+    // "--name value" pairs: the handler returns false on an unknown name or an invalid value
+    template <typename Handler>
+    bool parseOptions(int argc, char* argv[], Handler handler)
+    {
+        for (int i = 1; i < argc; i += 2)
+        {
+            if ((i + 1 >= argc) or (not handler(argv[i], argv[i + 1])))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Pseudo-random content, the same for a given size
+    inline void createFile(std::string const& path, int64_t size)
+    {
+        std::mt19937 rng(static_cast<uint32_t>(size));
+        std::string content(size, 0);
+        for (auto& c : content)
+        {
+            c = static_cast<char>(rng());
+        }
+        std::ofstream(path, std::ios::binary).write(content.data(), content.size());
+    }
+
+    // The server serves the current directory: work in a scratch one (with an "out" directory for the downloads),
+    // removed on destruction
+    class ScratchDirectory
+    {
+    public:
+        explicit ScratchDirectory(std::string const& name)
+            : origin_{std::filesystem::current_path()}
+            , path_{std::filesystem::temp_directory_path() / (name + "." + std::to_string(getpid()))}
+        {
+            std::filesystem::create_directories(path_ / "out");
+            std::filesystem::current_path(path_);
+        }
+
+        ~ScratchDirectory()
+        {
+            std::filesystem::current_path(origin_);
+            std::filesystem::remove_all(path_);
+        }
+
+        ScratchDirectory(ScratchDirectory const&) = delete;
+        ScratchDirectory& operator=(ScratchDirectory const&) = delete;
+
+    private:
+        std::filesystem::path origin_;
+        std::filesystem::path path_;
+    };
+}
+
+#endif
@@ -0,0 +1,535 @@
+// Load generator: thousands of simulated clients downloading from one server, to find out how far it scales
+// before it degrades (e.g. a boot storm of a whole cluster).
+//
+// Each thread runs its clients as state machines over non-blocking sockets (one TID per client) and an epoll
+// loop, so that the number of clients is not bound by the number of threads. Clients arrive at the requested
+// rate (Poisson arrivals) and download one file drawn from the mix. A lossy network is simulated by one loss
+// rate shared by all the clients: each datagram sent or received by any client is dropped with that probability.
+// For each arrival rate, report the client goodput (bytes received by the clients per second of the run), the
+// transfer latency percentiles and the failures.
+
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <thread>
+
+#include "tftp/protocol.h"
+
+#include "common.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct File
+    {
+        std::string name;
+        double weight;
+    };
+
+    struct Options
+    {
+        std::string server{"::1"};
+        char const* port{"69"};
+        std::vector<File> files;
+        int clients{1000};
+        std::vector<double> rates{ 0 };             //< arrivals per second, 0: all clients at once
+        int threads{4};
+        int64_t block_size{1428};
+        int64_t window_size{16};
+        double loss{0};                             //< per datagram of any client, both directions
+        std::chrono::milliseconds timeout{1000};   //< doubled on each retry, as PXE clients do
+        int retries{5};
+        static constexpr int MAX_BACKOFF_SHIFT = 6; //< the timeout stops doubling after that many retries
+        uint32_t seed{1};
+    };
+
+    enum Outcome
+    {
+        RUNNING,
+        SUCCESS,
+        TIMEOUT,
+        PEER_ERROR,
+        SOCKET_ERROR
+    };
+
+    struct SimulatedClient
+    {
+        Clock::time_point arrival;
+        std::string const* file;
+
+        int fd{-1};
+        tftp::Request request;
+        sockaddr_storage tid{};                     //< server end of the transfer, known after its first answer
+        socklen_t tid_size{0};
+        bool is_started{false};                     //< OACK or first DATA received
+        std::vector<char> last_sent;                //< sent again on timeout
+        Clock::time_point begin;
+        Clock::time_point deadline;
+        int retries{0};
+
+        int64_t next_block{1};
+        int64_t last_acked_block{0};
+        int64_t nacked_block{0};                    //< gap already reported for this block
+        int64_t bytes{0};
+
+        Outcome outcome{RUNNING};
+        double seconds{0};
+    };
+
+    // Clients of one thread, sorted by arrival
+    class Runner
+    {
+    public:
+        Runner(Options const& options, sockaddr_storage const& server, socklen_t server_size, uint32_t seed)
+            : options_{options}
+            , server_{server}
+            , server_size_{server_size}
+            , rng_{seed}
+        {
+        }
+
+        std::vector<SimulatedClient>& clients() { return clients_; }
+
+        void run()
+        {
+            epoll_ = epoll_create1(EPOLL_CLOEXEC);
+            std::vector<char> buffer(tftp::BLKSIZE.max + 4);
+            epoll_event events[256];
+            size_t next_arrival = 0;
+
+            while (finished_ < clients_.size())
+            {
+                auto now = Clock::now();
+                for (; (next_arrival < clients_.size()) and (clients_[next_arrival].arrival <= now); ++next_arrival)
+                {
+                    start(next_arrival);
+                }
+
+                // One timer per running client: a deadline pushed back meanwhile is rescheduled lazily
+                while ((not timers_.empty()) and (timers_.top().first <= now))
+                {
+                    size_t id = timers_.top().second;
+                    timers_.pop();
+                    SimulatedClient& client = clients_[id];
+                    if (client.outcome != RUNNING)
+                    {
+                        continue;
+                    }
+                    if (client.deadline > now)
+                    {
+                        timers_.push({client.deadline, id});
+                        continue;
+                    }
+                    onTimeout(client);
+                    if (client.outcome == RUNNING)
+                    {
+                        timers_.push({client.deadline, id});
+                    }
+                }
+
+                Clock::time_point wakeup = now + std::chrono::milliseconds(100);
+                if (next_arrival < clients_.size())
+                {
+                    wakeup = std::min(wakeup, clients_[next_arrival].arrival);
+                }
+                if (not timers_.empty())
+                {
+                    wakeup = std::min(wakeup, timers_.top().first);
+                }
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(wakeup - now);
+
+                int n = epoll_wait(epoll_, events, 256, static_cast<int>(std::max<int64_t>(wait.count(), 0)));
+                for (int i = 0; i < n; ++i)
+                {
+                    SimulatedClient& client = clients_[events[i].data.u32];
+                    while (client.outcome == RUNNING)
+                    {
+                        sockaddr_storage from;
+                        socklen_t from_size = sizeof(from);
+                        ssize_t rec = recvfrom(client.fd, buffer.data(), buffer.size(), 0,
+                                               reinterpret_cast<sockaddr*>(&from), &from_size);
+                        if (rec < 0)
+                        {
+                            break;
+                        }
+                        onPacket(client, buffer.data(), rec, from, from_size);
+                    }
+                }
+            }
+            close(epoll_);
+        }
+
+    private:
+        bool isLost()
+        {
+            return (options_.loss > 0) and (std::uniform_real_distribution<double>(0, 1)(rng_) < options_.loss);
+        }
+
+        void start(size_t id)
+        {
+            SimulatedClient& client = clients_[id];
+            client.begin = Clock::now();
+
+            client.fd = socket(server_.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (client.fd < 0)
+            {
+                finish(client, SOCKET_ERROR);
+                return;
+            }
+            int buffer_size = static_cast<int>(options_.window_size * (options_.block_size + 4));
+            setsockopt(client.fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u32 = static_cast<uint32_t>(id);
+            epoll_ctl(epoll_, EPOLL_CTL_ADD, client.fd, &event);
+
+            sendRequest(client);
+            timers_.push({client.deadline, id});
+        }
+
+        // Also used to start over when the negotiation failed (the server gives up after one OACK)
+        void sendRequest(SimulatedClient& client)
+        {
+            client.tid_size = 0;
+            client.is_started = false;
+            client.request.operation = tftp::opcode::RRQ;
+            client.request.mode = tftp::Mode::OCTET;
+            client.request.filename = *client.file;
+            client.request.block_size.value = options_.block_size;
+            client.request.block_size.is_enable = true;
+            client.request.window_size.value = options_.window_size;
+            client.request.window_size.is_enable = true;
+            send(client, tftp::forgeRequest(client.request));
+        }
+
+        void finish(SimulatedClient& client, Outcome outcome)
+        {
+            client.outcome = outcome;
+            client.seconds = std::chrono::duration<double>(Clock::now() - client.begin).count();
+            if (client.fd >= 0)
+            {
+                close(client.fd); // also removed from the epoll set
+                client.fd = -1;
+            }
+            ++finished_;
+        }
+
+        void send(SimulatedClient& client, std::vector<char> packet)
+        {
+            client.last_sent = std::move(packet);
+            int shift = std::min(client.retries, Options::MAX_BACKOFF_SHIFT);
+            client.deadline = Clock::now() + options_.timeout * (1 << shift);  //< exponential backoff
+            if (isLost())
+            {
+                return;
+            }
+
+            sockaddr const* target = reinterpret_cast<sockaddr const*>(&server_);
+            socklen_t target_size = server_size_;
+            if (client.tid_size > 0)
+            {
+                target = reinterpret_cast<sockaddr const*>(&client.tid);
+                target_size = client.tid_size;
+            }
+            sendto(client.fd, client.last_sent.data(), client.last_sent.size(), 0, target, target_size);
+        }
+
+        void ack(SimulatedClient& client, int64_t block)
+        {
+            client.last_acked_block = block;
+            send(client, tftp::forgeAck(static_cast<int>(block & 0xFFFF)));
+        }
+
+        void onTimeout(SimulatedClient& client)
+        {
+            if (++client.retries > options_.retries)
+            {
+                finish(client, TIMEOUT);
+                return;
+            }
+            if (client.next_block == 1)
+            {
+                sendRequest(client);
+                return;
+            }
+            send(client, std::move(client.last_sent));
+        }
+
+        void onPacket(SimulatedClient& client, char const* data, size_t size, sockaddr_storage const& from, socklen_t from_size)
+        {
+            if (isLost())
+            {
+                return;
+            }
+            if (client.tid_size == 0)
+            {
+                client.tid = from;
+                client.tid_size = from_size;
+            }
+            else if ((from_size != client.tid_size) or (memcmp(&from, &client.tid, from_size) != 0))
+            {
+                return; // not our transfer
+            }
+
+            switch (tftp::getOpcode(data, size))
+            {
+                case tftp::opcode::OACK:
+                {
+                    if (client.next_block != 1)
+                    {
+                        return;
+                    }
+                    if (not client.is_started)
+                    {
+                        if (tftp::parseOptionAck(data, size, client.request) < 0)
+                        {
+                            finish(client, PEER_ERROR);
+                            return;
+                        }
+                        client.is_started = true;
+                    }
+                    client.retries = 0;
+                    ack(client, 0); // also when the OACK is sent again: our ACK was lost
+                    return;
+                }
+                case tftp::opcode::DATA:
+                {
+                    break;
+                }
+                default:
+                {
+                    finish(client, PEER_ERROR);
+                    return;
+                }
+            }
+
+            if (not client.is_started)
+            {
+                // Options ignored by the server
+                client.request.block_size.value = tftp::BLKSIZE.default_value;
+                client.request.window_size.value = tftp::WINDOWSIZE.default_value;
+                client.is_started = true;
+            }
+
+            int block = tftp::parseData(data, size);
+            if (block < 0)
+            {
+                finish(client, PEER_ERROR);
+                return;
+            }
+            int64_t absolute_block = client.next_block + static_cast<int16_t>(static_cast<uint16_t>(block - client.next_block));
+
+            if (absolute_block > client.next_block)
+            {
+                // Gap: ACK the last block received in order to restart the window there (once per gap)
+                if (client.nacked_block != client.next_block)
+                {
+                    client.nacked_block = client.next_block;
+                    ack(client, client.next_block - 1);
+                }
+                return;
+            }
+            if (absolute_block < client.next_block)
+            {
+                if (absolute_block == client.last_acked_block)
+                {
+                    ack(client, client.next_block - 1); // the server resends the previous window: its ACK was lost
+                }
+                return;
+            }
+
+            ++client.next_block;
+            client.retries = 0;
+            client.deadline = Clock::now() + options_.timeout;
+            client.bytes += static_cast<int64_t>(size) - 4;
+            if (static_cast<int64_t>(size) - 4 < client.request.block_size.value)
+            {
+                ack(client, absolute_block);
+                finish(client, SUCCESS);
+                return;
+            }
+            if (absolute_block - client.last_acked_block >= client.request.window_size.value)
+            {
+                ack(client, absolute_block);
+            }
+        }
+
+        Options const& options_;
+        sockaddr_storage server_;
+        socklen_t server_size_;
+        std::mt19937 rng_;
+        int epoll_{-1};
+        std::vector<SimulatedClient> clients_;
+        size_t finished_{0};
+
+        using Timer = std::pair<Clock::time_point, size_t>;
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    };
+
+    void usage()
+    {
+        printf("Usage: tftp_loadgen --files f [--server address] [--port p] [--clients n] [--rate l] [--threads n]\n"
+               "                    [--blksize n] [--windowsize n] [--loss p] [--timeout ms] [--retries n] [--seed n]\n"
+               "  f: comma separated list of name[:weight], files downloaded by the clients (weight defaults to 1)\n"
+               "  l: comma separated list of arrival rates (clients per second, 0: all at once), one run per rate\n"
+               "  p: probability to drop a datagram, the same for all the clients and both directions\n");
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    bool is_valid = bench::parseOptions(argc, argv, [&](char const* arg, char const* value)
+    {
+        if      (strcmp(arg, "--server")     == 0) { options.server      = value;                              }
+        else if (strcmp(arg, "--port")       == 0) { options.port        = value;                              }
+        else if (strcmp(arg, "--clients")    == 0) { options.clients     = atoi(value);                        }
+        else if (strcmp(arg, "--threads")    == 0) { options.threads     = std::max(atoi(value), 1);           }
+        else if (strcmp(arg, "--blksize")    == 0) { options.block_size  = atoll(value);                       }
+        else if (strcmp(arg, "--windowsize") == 0) { options.window_size = atoll(value);                       }
+        else if (strcmp(arg, "--loss")       == 0) { options.loss        = atof(value);                        }
+        else if (strcmp(arg, "--timeout")    == 0) { options.timeout     = std::chrono::milliseconds(atoi(value)); }
+        else if (strcmp(arg, "--retries")    == 0) { options.retries     = atoi(value);                        }
+        else if (strcmp(arg, "--seed")       == 0) { options.seed        = static_cast<uint32_t>(atoll(value)); }
+        else if (strcmp(arg, "--rate")       == 0)
+        {
+            options.rates.clear();
+            for (auto const& item : bench::split(value))
+            {
+                options.rates.push_back(std::stod(item));
+            }
+        }
+        else if (strcmp(arg, "--files")      == 0)
+        {
+            for (auto const& item : bench::split(value))
+            {
+                size_t colon = item.rfind(':');
+                if (colon == std::string::npos)
+                {
+                    options.files.push_back({item, 1.0});
+                }
+                else
+                {
+                    options.files.push_back({item.substr(0, colon), std::stod(item.substr(colon + 1))});
+                }
+            }
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    });
+    if ((not is_valid) or options.files.empty() or (options.clients <= 0))
+    {
+        usage();
+        return -1;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(options.server.c_str(), options.port, &hints, &result) != 0)
+    {
+        fprintf(stderr, "cannot resolve %s\n", options.server.c_str());
+        return -1;
+    }
+    sockaddr_storage server{};
+    socklen_t server_size = result->ai_addrlen;
+    memcpy(&server, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+
+    // One socket per running client
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < static_cast<rlim_t>(options.clients) + 64)
+    {
+        fprintf(stderr, "warning: %lu file descriptors available, clients may fail to start\n", limit.rlim_cur);
+    }
+
+    std::vector<double> weights;
+    for (auto const& file : options.files)
+    {
+        weights.push_back(file.weight);
+    }
+
+    printf("%d clients from %d threads against %s port %s, blksize %ld windowsize %ld loss %.3f\n",
+           options.clients, options.threads, options.server.c_str(), options.port,
+           options.block_size, options.window_size, options.loss);
+    printf("%-10s %-9s %-14s %-11s %-10s %-10s %-10s %-10s %-9s %-9s %s\n", "rate (/s)", "seconds", "goodput (MB/s)",
+           "transfers/s", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)", "failed %", "timeouts", "errors");
+
+    for (auto rate : options.rates)
+    {
+        std::mt19937 rng(options.seed);
+        std::discrete_distribution<size_t> pick_file(weights.begin(), weights.end());
+        std::exponential_distribution<double> interval(rate > 0 ? rate : 1);
+
+        std::vector<Runner> runners;
+        for (int i = 0; i < options.threads; ++i)
+        {
+            runners.emplace_back(options, server, server_size, options.seed + i + 1);
+        }
+
+        auto begin = Clock::now() + std::chrono::milliseconds(10);
+        double arrival = 0;
+        for (int i = 0; i < options.clients; ++i)
+        {
+            SimulatedClient client;
+            client.arrival = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(arrival));
+            client.file = &options.files[pick_file(rng)].name;
+            runners[i % options.threads].clients().push_back(std::move(client));
+            if (rate > 0)
+            {
+                arrival += interval(rng);
+            }
+        }
+
+        std::vector<std::thread> threads;
+        for (auto& runner : runners)
+        {
+            threads.emplace_back([&runner]() { runner.run(); });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        std::vector<double> latencies;
+        int64_t bytes = 0;
+        int timeouts = 0;
+        int errors = 0;
+        for (auto& runner : runners)
+        {
+            for (auto const& client : runner.clients())
+            {
+                bytes += client.bytes;
+                switch (client.outcome)
+                {
+                    case SUCCESS: { latencies.push_back(client.seconds * 1e3); break; }
+                    case TIMEOUT: { ++timeouts;                                break; }
+                    default:      { ++errors;                                  break; }
+                }
+            }
+        }
+
+        printf("%-10.0f %-9.2f %-14.2f %-11.1f %-10.1f %-10.1f %-10.1f %-10.1f %-9.2f %-9d %d\n",
+               rate, seconds, bytes / seconds / 1024.0 / 1024.0, latencies.size() / seconds,
+               bench::percentile(latencies, 0.50), bench::percentile(latencies, 0.90), bench::percentile(latencies, 0.99),
+               bench::percentile(latencies, 1.0), 100.0 * (timeouts + errors) / options.clients, timeouts, errors);
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+// Transfer loops (processRead/processWrite) over the in-memory loopback link.
+//
+// The link runs on a virtual clock with seeded impairments: every scenario is deterministic and runs in a few
+// milliseconds of wall time. Reported times and rates are virtual, that is what a real network would show.
+
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "tftp/protocol.h"
+#include "tftp/loopback.h"
+#include "tftp/session.h"
+
+using namespace std::chrono;
+
+namespace
+{
+    struct Scenario
+    {
+        char const* name;
+        tftp::LinkConfig link;
+    };
+
+    tftp::LinkConfig lan()
+    {
+        tftp::LinkConfig config;
+        config.bandwidth = 125000000;  // 1 Gbit/s
+        config.latency = microseconds(50);
+        return config;
+    }
+
+    tftp::LinkConfig with(tftp::LinkConfig config, void (*change)(tftp::LinkConfig&))
+    {
+        change(config);
+        return config;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int size_mb = 4;
+    if (argc > 1) { size_mb = atoi(argv[1]); }
+
+    std::string content(size_mb * 1024 * 1024, 0);
+    std::mt19937 rng(42);
+    for (auto& c : content)
+    {
+        c = static_cast<char>(rng());
+    }
+
+    std::vector<Scenario> scenarios =
+    {
+        { "lan",            lan() },
+        { "loss 0.1%",      with(lan(), [](tftp::LinkConfig& c) { c.loss = 0.001; }) },
+        { "loss 1%",        with(lan(), [](tftp::LinkConfig& c) { c.loss = 0.01; }) },
+        { "loss 5%",        with(lan(), [](tftp::LinkConfig& c) { c.loss = 0.05; }) },
+        { "duplicate 1%",   with(lan(), [](tftp::LinkConfig& c) { c.duplicate = 0.01; }) },
+        { "reorder 1%",     with(lan(), [](tftp::LinkConfig& c) { c.reorder = 0.01; c.reorder_delay = microseconds(200); }) },
+        { "wan 20ms",       with(lan(), [](tftp::LinkConfig& c) { c.latency = milliseconds(10); c.bandwidth = 12500000; }) },
+        { "wan 20ms, 1%",   with(lan(), [](tftp::LinkConfig& c) { c.latency = milliseconds(10); c.bandwidth = 12500000; c.loss = 0.01; }) },
+    };
+    std::vector<int64_t> window_sizes = { 1, 8, 32 };
+
+    printf("file %d MB, blksize 1428, timeout 100ms (virtual)\n", size_mb);
+    printf("%-16s %-8s %-12s %-10s %-10s %-8s %-8s %-8s %-10s %s\n",
+           "scenario", "window", "virtual (s)", "MB/s", "data sent", "lost", "resent", "window", "wall (ms)", "valid");
+
+    for (auto const& scenario : scenarios)
+    {
+        for (auto window_size : window_sizes)
+        {
+            tftp::Request request;
+            request.operation = tftp::opcode::RRQ;
+            request.mode = tftp::Mode::OCTET;
+            request.block_size.value = 1428;
+            request.window_size.value = window_size;
+
+            tftp::Link link(scenario.link, scenario.link);
+            link.a().setTimeout(100ms);
+            link.b().setTimeout(100ms);
+
+            std::istringstream input(content);
+            std::ostringstream output;
+
+            auto begin = steady_clock::now();
+            std::thread receiver([&]()
+            {
+                tftp::processWrite(request, link.b(), output);
+                link.b().close();
+            });
+            tftp::SessionMetrics metrics;
+            tftp::Session session;
+            session.metrics = &metrics;
+            tftp::processRead(request, link.a(), input, session);
+            link.a().close();
+            receiver.join();
+            auto end = steady_clock::now();
+
+            double seconds = duration<double>(link.now()).count();
+            tftp::LinkStats stats = link.stats(link.a());
+            printf("%-16s %-8ld %-12.4f %-10.2f %-10lu %-8lu %-8lu %-8.1f %-10.1f %s\n",
+                   scenario.name, window_size, seconds, size_mb / seconds, stats.sent, stats.lost,
+                   metrics[tftp::RETRANSMITS], metrics.window(),
+                   duration<double, std::milli>(end - begin).count(), (output.str() == content) ? "yes" : "NO");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Compare fragmented and MTU-fitting block sizes under injected loss.
+//
+// Transfers run over the in-memory loopback link which models IP fragmentation: a datagram bigger than the path
+// MTU is split in fragments and is lost as soon as one of them is lost. The link runs on a virtual clock, so
+// results are deterministic and reported times are the ones of the simulated network.
+
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "tftp/protocol.h"
+#include "tftp/loopback.h"
+
+using namespace std::chrono;
+
+namespace
+{
+    struct Result
+    {
+        double seconds;
+        bool valid;
+    };
+
+    Result transfer(std::string const& content, int64_t block_size, int mtu, double loss)
+    {
+        tftp::Request request;
+        request.operation = tftp::opcode::RRQ;
+        request.mode = tftp::Mode::OCTET;
+        request.block_size.value = block_size;
+        request.window_size.value = 8;
+
+        tftp::LinkConfig config;
+        config.bandwidth = 125000000;  // 1 Gbit/s
+        config.latency = microseconds(100);
+        config.mtu = mtu;
+        config.loss = loss;
+
+        tftp::Link link(config, config);
+        link.a().setTimeout(20ms);
+        link.b().setTimeout(20ms);
+
+        std::istringstream input(content);
+        std::ostringstream output;
+
+        std::thread receiver([&]()
+        {
+            tftp::processWrite(request, link.b(), output);
+            link.b().close();
+        });
+        tftp::processRead(request, link.a(), input);
+        link.a().close();
+        receiver.join();
+
+        return {duration<double>(link.now()).count(), output.str() == content};
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int mtu = 1500;
+    int size_mb = 4;
+    if (argc > 1) { mtu     = atoi(argv[1]); }
+    if (argc > 2) { size_mb = atoi(argv[2]); }
+
+    std::string content(size_mb * 1024 * 1024, 0);
+    std::mt19937 rng(42);
+    for (auto& c : content)
+    {
+        c = static_cast<char>(rng());
+    }
+
+    int64_t const fitting = tftp::maxBlockSize(mtu - 48);
+    std::vector<int64_t> block_sizes = { 512, fitting, 4096, 8192, 32768, tftp::BLKSIZE.max };
+    std::vector<double>  losses      = { 0.0, 0.001, 0.005, 0.01 };
+
+    printf("path MTU %d, file %d MB, window 8, 1 Gbit/s, 100us latency (virtual time)\n", mtu, size_mb);
+    printf("%-8s %-10s %-12s %-10s %-10s %s\n", "blksize", "fragments", "frag. loss", "time (s)", "MB/s", "valid");
+
+    for (auto block_size : block_sizes)
+    {
+        int fragments = static_cast<int>((block_size + 4 + 48 + mtu - 1) / mtu);
+        for (auto loss : losses)
+        {
+            Result r = transfer(content, block_size, mtu, loss);
+            printf("%-8ld %-10d %-12.3f %-10.3f %-10.2f %s\n",
+                   block_size, fragments, loss, r.seconds, size_mb / r.seconds, r.valid ? "yes" : "NO");
+        }
+    }
+
+    return 0;
+}
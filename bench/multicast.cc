@@ -0,0 +1,119 @@
+// Multicast benchmark: N clients download the same file at the same time (e.g. nodes booting the same initrd),
+// with one unicast transfer each and with RFC 2090 multicast. The server egress is reported as the number of
+// copies of the file it sent: N in unicast, about 1 in multicast (plus the blocks resent to late joiners).
+//
+// The group shall be routable on the host (default: ff15::7466:7470, site-local scope).
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "tftp/client.h"
+#include "tftp/log.h"
+#include "tftp/server.h"
+
+#include "common.h"
+
+namespace
+{
+    bool sameContent(std::string const& a, std::string const& b)
+    {
+        std::ifstream fa(a, std::ios::binary);
+        std::ifstream fb(b, std::ios::binary);
+        return std::equal(std::istreambuf_iterator<char>(fa), std::istreambuf_iterator<char>(),
+                          std::istreambuf_iterator<char>(fb), std::istreambuf_iterator<char>());
+    }
+
+    void usage()
+    {
+        printf("Usage: tftp_bench_multicast [--clients l] [--filesize MB] [--group address] [--port p]\n"
+               "  l: comma separated list of client counts\n");
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<int64_t> clients { 1, 8, 32 };
+    int64_t size_mb = 16;
+    char const* group = "ff15::7466:7470";
+    char const* port = "16972";
+
+    bool is_valid = bench::parseOptions(argc, argv, [&](char const* arg, char const* value)
+    {
+        if      (strcmp(arg, "--clients")  == 0) { clients = bench::parseList(value); }
+        else if (strcmp(arg, "--filesize") == 0) { size_mb = atoll(value);            }
+        else if (strcmp(arg, "--group")    == 0) { group   = value;                   }
+        else if (strcmp(arg, "--port")     == 0) { port    = value;                   }
+        else
+        {
+            return false;
+        }
+        return true;
+    });
+    if (not is_valid)
+    {
+        usage();
+        return -1;
+    }
+
+    tftp::log::setLevel(tftp::LogLevel::WARNING);
+
+    int64_t file_size = size_mb * 1024 * 1024;
+    bench::ScratchDirectory workdir("tftp_bench_multicast");
+    bench::createFile("image", file_size);
+
+    printf("%-10s %-10s %-10s %-14s %-10s %s\n", "clients", "mode", "copies", "total (MB/s)", "seconds", "failed");
+    for (auto count : clients)
+    {
+        for (bool multicast : { false, true })
+        {
+            tftp::ServerConfig server_config;
+            server_config.address = "::1";
+            server_config.port = port;
+            server_config.max_sessions = static_cast<int>(count);
+            server_config.max_pending = static_cast<int>(count);
+            server_config.multicast_address = group;
+
+            tftp::Server server(server_config);
+            if (server.start())
+            {
+                fprintf(stderr, "cannot start the server on port %s\n", port);
+                return -1;
+            }
+
+            tftp::ClientConfig config;
+            config.server = "::1";
+            config.port = atoi(port);
+            config.max_concurrency = static_cast<int>(count);
+            config.block_size = 1428;
+            config.timeout = std::chrono::milliseconds(1000);
+            config.multicast = multicast;
+
+            std::vector<tftp::Job> jobs;
+            for (int64_t i = 0; i < count; ++i)
+            {
+                jobs.push_back({tftp::opcode::RRQ, "image", "out/image_" + std::to_string(i)});
+            }
+
+            tftp::Client client(config);
+            tftp::BatchResult result = client.run(jobs);
+            server.stop();
+
+            for (auto const& job : jobs)
+            {
+                if (not sameContent("image", job.local))
+                {
+                    ++result.failed;
+                }
+            }
+
+            double copies = static_cast<double>(server.metrics()[tftp::BYTES_SENT]) / file_size;
+            printf("%-10ld %-10s %-10.2f %-14.1f %-10.2f %d\n", count, multicast ? "multicast" : "unicast", copies,
+                   result.throughput() / 1024.0 / 1024.0, result.seconds, result.failed);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,248 @@
+// Replay recorded sessions (ServerConfig::record_directory) against a server: the client side of each recording
+// is sent again, at the recorded timing or as fast as possible, to measure the transfer loops on real traffic
+// (e.g. the ACK pattern of a given client firmware).
+//
+// Each client packet is sent once the server packet that preceded it in the recording is received (same opcode
+// and block), or after the timeout if the server behaves differently. Then, unless --fast, not before its
+// recorded time since the request (millisecond accuracy).
+//
+// The server shall serve the files of the recorded downloads (with the same size), uploads are written to it.
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "tftp/log.h"
+#include "tftp/recording.h"
+#include "tftp/OS/Socket.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Replay
+    {
+        double seconds{0};
+        int sent{0};
+        int received{0};
+        int missed{0};      //< expected server packets not received before the timeout
+    };
+
+    class Player
+    {
+    public:
+        Player(char const* server, int port, std::chrono::milliseconds timeout)
+            : socket_{server, port}
+            , timeout_{timeout}
+        {
+            // do not lose the windows of the server while waiting
+            socket_.setBufferSize(8 * 1024 * 1024, 8 * 1024 * 1024);
+        }
+
+        // Read until deadline, return true as soon as a packet with the same opcode and block (or first option
+        // bytes) as expected is received
+        bool waitFor(Clock::time_point deadline, std::vector<char> const* expected)
+        {
+            while (true)
+            {
+                auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+                if (remaining.count() <= 0)
+                {
+                    return false;
+                }
+                if (remaining != read_timeout_)
+                {
+                    read_timeout_ = remaining;
+                    socket_.setTimeout(remaining);
+                }
+                int rec = socket_.read(packet_);
+                if (rec < 0)
+                {
+                    continue;
+                }
+                ++replay_.received;
+                if (not has_tid_)
+                {
+                    socket_.switchToLast(); // server answers from the TID of the transfer
+                    has_tid_ = true;
+                }
+                if (expected == nullptr)
+                {
+                    continue;
+                }
+                size_t header = std::min<size_t>(expected->size(), 4);
+                if ((static_cast<size_t>(rec) >= header) and std::equal(expected->begin(), expected->begin() + header, packet_.begin()))
+                {
+                    return true;
+                }
+            }
+        }
+
+        Replay play(std::vector<tftp::Record> const& records, bool is_fast)
+        {
+            packet_.resize(tftp::BLKSIZE.max + 4);
+            auto begin = Clock::now();
+            std::chrono::microseconds origin{0};
+            std::vector<char> const* expected = nullptr;  //< last server packet recorded before the next client one
+
+            for (auto const& record : records)
+            {
+                switch (record.type)
+                {
+                    case tftp::RecordType::REQUEST:
+                    {
+                        origin = record.time;
+                        send(record);
+                        break;
+                    }
+                    case tftp::RecordType::SENT:
+                    {
+                        expected = &record.data;
+                        break;
+                    }
+                    case tftp::RecordType::RECEIVED:
+                    {
+                        wait(record, expected, is_fast, begin, origin);
+                        expected = nullptr;
+                        send(record);
+                        break;
+                    }
+                    default:
+                    {
+                        break; // the server timed out: silence is replayed by the absence of packet
+                    }
+                }
+            }
+            if (expected != nullptr)
+            {
+                // The server ends the session (final ACK of an upload)
+                if (not waitFor(Clock::now() + timeout_, expected))
+                {
+                    ++replay_.missed;
+                }
+            }
+
+            replay_.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+            return replay_;
+        }
+
+    private:
+        void wait(tftp::Record const& record, std::vector<char> const* expected, bool is_fast,
+                  Clock::time_point begin, std::chrono::microseconds origin)
+        {
+            // Never run ahead of the server: the recorded packet answered the previous server one (a replayed
+            // window sent too early would overflow the server socket and could not be recovered)
+            if ((expected != nullptr) and (not waitFor(Clock::now() + timeout_, expected)))
+            {
+                ++replay_.missed;
+            }
+            if (not is_fast)
+            {
+                waitFor(begin + (record.time - origin), nullptr);
+            }
+        }
+
+        void send(tftp::Record const& record)
+        {
+            // DATA payloads are not recorded: send zeros of the recorded size
+            std::vector<char> packet = record.data;
+            packet.resize(record.size, 0);
+            socket_.write(packet);
+            ++replay_.sent;
+        }
+
+        tftp::Socket socket_;
+        std::chrono::milliseconds timeout_;
+        std::chrono::milliseconds read_timeout_{0};
+        std::vector<char> packet_;
+        bool has_tid_{false};
+        Replay replay_;
+    };
+
+    void usage()
+    {
+        printf("Usage: tftp_replay [--server address] [--port p] [--fast] [--repeat n] [--timeout ms] recording...\n"
+               "  address: IPv6 address of the server (::1), --fast: do not wait for the recorded timing\n");
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    char const* server = "::1";
+    int port = 69;
+    bool is_fast = false;
+    int repeat = 1;
+    std::chrono::milliseconds timeout{1000};
+    std::vector<char const*> paths;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        char const* arg = argv[i];
+        if (strcmp(arg, "--fast") == 0)
+        {
+            is_fast = true;
+            continue;
+        }
+        if (strncmp(arg, "--", 2) != 0)
+        {
+            paths.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage();
+            return -1;
+        }
+        char const* value = argv[++i];
+
+        if      (strcmp(arg, "--server")  == 0) { server  = value;                                   }
+        else if (strcmp(arg, "--port")    == 0) { port    = atoi(value);                             }
+        else if (strcmp(arg, "--repeat")  == 0) { repeat  = std::max(atoi(value), 1);                }
+        else if (strcmp(arg, "--timeout") == 0) { timeout = std::chrono::milliseconds(atoi(value));  }
+        else
+        {
+            usage();
+            return -1;
+        }
+    }
+    if (paths.empty())
+    {
+        usage();
+        return -1;
+    }
+
+    tftp::log::setLevel(tftp::LogLevel::WARNING);
+
+    printf("%-40s %-13s %-13s %-13s %-8s %-8s %s\n", "recording", "recorded (ms)", "min (ms)", "median (ms)",
+           "sent", "received", "missed");
+    int failed = 0;
+    for (auto path : paths)
+    {
+        std::ifstream input(path, std::ifstream::binary);
+        std::vector<tftp::Record> records;
+        if ((not input) or (tftp::readRecording(input, records) < 0) or records.empty()
+            or (records.front().type != tftp::RecordType::REQUEST))
+        {
+            fprintf(stderr, "%s: not a session recording\n", path);
+            ++failed;
+            continue;
+        }
+        double recorded = std::chrono::duration<double, std::milli>(records.back().time - records.front().time).count();
+
+        std::vector<double> durations;
+        Replay last;
+        for (int i = 0; i < repeat; ++i)
+        {
+            Player player(server, port, timeout);
+            last = player.play(records, is_fast);
+            durations.push_back(last.seconds * 1e3);
+        }
+        std::sort(durations.begin(), durations.end());
+
+        printf("%-40s %-13.2f %-13.2f %-13.2f %-8d %-8d %d\n", path, recorded, durations.front(),
+               durations[durations.size() / 2], last.sent, last.received, last.missed);
+    }
+
+    return (failed == 0) ? 0 : 2;
+}
@@ -1,34 +1,27 @@
-#include <fstream>
 #include <filesystem>
 #include <cstring>
 
-#include "tftp/protocol.h"
-#include "tftp/OS/Socket.h"
-
-using namespace std::chrono;
+#include "tftp/client.h"
 
 int main(int argc, char* argv[])
 {
-    if (argc != 4)
+    if (argc < 4)
     {
-        printf("Usage: client server [put/get] file\n");
+        printf("Usage: client server [put/get] file [file...]\n");
         return -1;
     }
 
-    char const* server   = argv[1];
-    char const* req      = argv[2];
-    char const* filepath = argv[3];
+    char const* server = argv[1];
+    char const* req    = argv[2];
 
-    tftp::Request request;
-    request.mode = tftp::Mode::OCTET;
-    request.filename = std::filesystem::path(filepath).filename();
+    tftp::opcode operation;
     if (strncmp("put", req, 3) == 0)
     {
-        request.operation = tftp::opcode::WRQ;
+        operation = tftp::opcode::WRQ;
     }
     else if (strncmp("get", req, 3) == 0)
     {
-        request.operation = tftp::opcode::RRQ;
+        operation = tftp::opcode::RRQ;
     }
     else
     {
@@ -36,87 +29,32 @@ int main(int argc, char* argv[])
         return -1;
     }
 
-    tftp::Socket socket(server, 69);
-    socket.setTimeout(5s);
-
-    // set options
-    request.window_size.value = 32;
-    request.window_size.is_enable = true;
-    request.block_size.value  = 1024;
-    request.block_size.is_enable = true;
-
-    std::vector<char> packet = forgeRequest(request);
-    if (socket.write(packet) < 0)
+    std::vector<tftp::Job> jobs;
+    for (int i = 3; i < argc; ++i)
     {
-        perror("write request");
-        return -1;
+        std::string filename = std::filesystem::path(argv[i]).filename();
+        jobs.push_back({operation, filename, argv[i]});
     }
 
-    packet.resize(512);
-    int rec = socket.read(packet);
-    if (rec < 0)
-    {
-        perror("read request reply");
-        return -1;
-    }
-    socket.switchToLast();
+    tftp::ClientConfig config;
+    config.server = server;
 
-    if (tftp::getOpcode(packet.data(), packet.size()) == tftp::opcode::ERROR)
-    {
-        tftp::error_code code;
-        std::string msg;
-        tftp::parseError(packet.data(), packet.size(), code, msg);
-
-        printf("Error recevied from server: <%s>\n", msg.c_str());
-        return 2;
-    }
+    tftp::Client client(config);
+    tftp::BatchResult result = client.run(jobs);
 
-    // check OACK answer (if server can handles our options)
-    if (tftp::parseOptionAck(packet.data(), rec, request) == 0)
+    for (size_t i = 0; i < jobs.size(); ++i)
     {
-        if (request.operation == tftp::opcode::RRQ)
+        auto const& job = result.jobs[i];
+        if (job.error != 0)
         {
-            packet = tftp::forgeAck(0);
-            if (socket.write(packet) < 0)
-            {
-                perror("write request");
-                return -1;
-            }
+            printf("%-32s: error: %s\n", jobs[i].local.c_str(), toString(tftp::error_code(-job.error)));
+            continue;
         }
+        printf("%-32s: %ld bytes in %.3fs (%.2f MB/s)\n", jobs[i].local.c_str(), job.bytes, job.seconds,
+               job.throughput() / 1024.0 / 1024.0);
     }
-    else
-    {
-        int block = tftp::parseAck(packet.data(), rec);
-        if (block < 0)
-        {
-            perror("Parse ack");
-            return -1;
-        }
-        if (block != 0)
-        {
-            printf("Ack value is unexpected: %d\n", block);
-            return -1;
-        }
-    }
-    printf("opcode      : %x\n",   request.operation);
-    printf("mode        : %s\n",   toString(request.mode));
-    printf("filename    : %s\n", request.filename.c_str());
-    for (auto const& option : request.supported_options)
-    {
-        printf("%-12s: %-4ld (%d)\n", option->name, option->value, option->is_enable);
-    }
-
-    std::fstream file;
-    if (request.operation == tftp::opcode::WRQ)
-    {
-        file.open(filepath, std::fstream::in | std::fstream::binary);
-        tftp::processRead(request, socket, file);
-    }
-    else
-    {
-        file.open(filepath, std::fstream::out | std::fstream::binary | std::fstream::trunc);
-        tftp::processWrite(request, socket, file);
-    }
+    printf("%zu files, %d failed: %ld bytes in %.3fs (%.2f MB/s)\n", jobs.size(), result.failed,
+           result.bytes, result.seconds, result.throughput() / 1024.0 / 1024.0);
 
-    return 0;
+    return (result.failed == 0) ? 0 : 2;
 }
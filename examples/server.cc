@@ -1,97 +1,106 @@
-#include <sys/stat.h>
-
-#include <fstream>
+#include <cstdlib>
+#include <cstdio>
 #include <cstring>
+#include <thread>
 
-#include "tftp/protocol.h"
-#include "tftp/OS/Socket.h"
+#include "tftp/log.h"
+#include "tftp/server.h"
 
+using namespace std::chrono;
 
-int main()
+namespace
 {
-    // Create UDP socket
-    tftp::Socket listener;
-    if (listener.bind("::", "69"))
+    void usage()
     {
-        return -1;
+        printf("Usage: server [--name value]...\n"
+               "  --global-rate B/s      rate limit of all the sessions, 0: unlimited\n"
+               "  --client-rate B/s      rate limit of each client, 0: unlimited\n"
+               "  --max-sessions n       sessions served at the same time\n"
+               "  --max-pending n        requests waiting for a session, the next ones are refused\n"
+               "  --trace-dir dir        Chrome trace of each session (library built with TFTP_TRACING)\n"
+               "  --log-level 0-4        0 (debug) to 4 (none)\n"
+               "  --record-dir dir       packets of each session, replayed with tftp_replay\n"
+               "  --multicast group      RFC 2090 downloads on this group, e.g. ff15::7466:7470\n"
+               "  --memory-budget bytes  socket buffers shared by the sessions, 0: unlimited\n");
     }
-    printf("Socket created successfully\n");
-    printf("Listening for incoming messages...\n\n");
 
-    // Receive client's message:
-    while (true)
+    // 0 (debug) to 4 (none), -1 if invalid
+    int parseLogLevel(char const* value)
     {
-        char request_buffer[512];
-        int rec = listener.read(request_buffer, sizeof(request_buffer));
-        if (rec < 0)
+        char* end = nullptr;
+        long level = strtol(value, &end, 10);
+        bool is_valid = (end != value) and (*end == '\0')
+                    and (level >= 0) and (level <= static_cast<long>(tftp::LogLevel::NONE));
+        return is_valid ? static_cast<int>(level) : -1;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    tftp::ServerConfig config;
+    int log_level = static_cast<int>(tftp::LogLevel::INFO);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        char const* arg = argv[i];
+        if (i + 1 >= argc)
         {
-            perror("Couldn't receive\n");
+            usage();
             return -1;
         }
+        char const* value = argv[++i];
 
-        // Parse
-        tftp::Request request;
-        int ret = tftp::parseRequest(request_buffer, rec, request);
-        if (ret != 0)
+        if      (strcmp(arg, "--global-rate")   == 0) { config.global_rate = strtoll(value, nullptr, 10); }
+        else if (strcmp(arg, "--client-rate")   == 0) { config.client_rate = strtoll(value, nullptr, 10); }
+        else if (strcmp(arg, "--max-sessions")  == 0) { config.max_sessions = atoi(value); }
+        else if (strcmp(arg, "--max-pending")   == 0) { config.max_pending = atoi(value); }
+        else if (strcmp(arg, "--trace-dir")     == 0) { config.trace_directory = value; }
+        else if (strcmp(arg, "--log-level")     == 0) { log_level = parseLogLevel(value); }
+        else if (strcmp(arg, "--record-dir")    == 0) { config.record_directory = value; }
+        else if (strcmp(arg, "--multicast")     == 0) { config.multicast_address = value; }
+        else if (strcmp(arg, "--memory-budget") == 0) { config.memory_budget = strtoll(value, nullptr, 10); }
+        else
         {
-            printf("aie: %s\n", strerror(ret));
+            usage();
             return -1;
         }
-        printf("opcode      : %x\n",   request.operation);
-        printf("mode        : %s\n",   toString(request.mode));
-        printf("filename    : %s\n", request.filename.c_str());
-        for (auto const& option : request.supported_options)
-        {
-            printf("%-12s: %-4ld (%d)\n", option->name, option->value, option->is_enable);
-        }
+    }
+    if (log_level < 0)
+    {
+        usage();
+        return -1;
+    }
+    tftp::log::setLevel(tftp::LogLevel(log_level));
 
-        auto begin = std::chrono::steady_clock::now();
+    tftp::Server server(config);
+    if (server.start())
+    {
+        return -1;
+    }
+    TFTP_LOG(INFO, "Socket created successfully\n");
+    TFTP_LOG(INFO, "Listening for incoming messages...\n\n");
 
-        // Start transfer
-        tftp::Socket transferSocket = listener.createSocket();
-        std::fstream file;
+    tftp::ServerStats last{};
+    while (true)
+    {
+        std::this_thread::sleep_for(10s);
 
-        std::vector<char> reply = tftp::forgeOptionAck(request);
-        if (request.operation == tftp::opcode::WRQ)
-        {
-            file.open(request.filename, std::fstream::out | std::fstream::binary | std::fstream::trunc);
-            if (reply.size() == 0)
-            {
-                reply = tftp::forgeAck(0);
-            }
-            transferSocket.write(reply);
-            tftp::processWrite(request, transferSocket, file);
-        }
-        else
+        tftp::ServerStats stats = server.stats();
+        if ((stats.accepted == last.accepted) and (stats.rejected == last.rejected))
         {
-            file.open(request.filename, std::fstream::in | std::fstream::binary);
-            if (reply.size() != 0)
-            {
-                // send OACK
-                transferSocket.write(reply);
-
-                // wait for OACK ack (0)
-                char ack[4];
-                transferSocket.read(ack, 4);
-                int oack_ack = tftp::parseAck(ack, 4);
-                if (oack_ack != 0)
-                {
-                    printf("Oops\n");
-                    continue; // Abort transfer
-                }
-            }
-            tftp::processRead(request, transferSocket, file);
+            continue;
         }
+        last = stats;
 
-        struct stat stat_buf;
-        (void) stat(request.filename.c_str(), &stat_buf);
-        double file_size = stat_buf.st_size / 1024.0 / 1024.0;
-        file.close();
+        TFTP_LOG(INFO, "sessions: %ld active, %ld pending | accepted: %lu rejected: %lu duplicates: %lu invalid: %lu\n",
+                 stats.active_sessions, stats.pending_sessions,
+                 stats.accepted, stats.rejected, stats.duplicates, stats.invalid);
 
-        auto end = std::chrono::steady_clock::now();
-        double elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0;
-        std::cout << "Transfer " << file_size << "MB in " << elapsed << "s" << std::endl;
-        std::cout << "-> " << file_size / elapsed << "MB/s" << std::endl;
+        tftp::Counters metrics = server.metrics();
+        TFTP_LOG(INFO, "transfers: %lu sent, %lu received | retransmits: %lu timeouts: %lu dropped: %lu\n",
+                 metrics[tftp::BYTES_SENT], metrics[tftp::BYTES_RECEIVED],
+                 metrics[tftp::RETRANSMITS], metrics[tftp::TIMEOUTS], metrics[tftp::DROPPED]);
     }
 
     return 0;
@@ -0,0 +1,70 @@
+#ifndef TFTP_OS_LINUX_FILE_H
+#define TFTP_OS_LINUX_FILE_H
+
+#include <streambuf>
+
+#include "tftp/protocol.h"
+
+namespace tftp
+{
+    // Size of the file in bytes, -1 if it cannot be read
+    int64_t fileSize(char const* path);
+
+    // Check that the filesystem hosting path can store size bytes (space used by an existing file is reusable)
+    // return 0 on success, -error_code otherwise
+    int checkFreeSpace(char const* path, int64_t size);
+
+    // Reserve size bytes for path without changing its size so that the upload is written in place
+    // return 0 on success (or if the filesystem does not support it), -error_code otherwise
+    int preallocate(char const* path, int64_t size);
+
+    // When the data of an upload is guaranteed to be on disk
+    enum class Durability
+    {
+        NONE,       //< left to the kernel writeback
+        AT_END,     //< fdatasync before the final ACK
+        PERIODIC    //< fdatasync every sync_interval bytes and before the final ACK
+    };
+
+    // Upload sink: received blocks are coalesced in a pooled aligned buffer written with O_DIRECT in large aligned
+    // chunks, so that uploads do not evict the page cache. Falls back to buffered I/O when the filesystem does
+    // not support O_DIRECT.
+    // pubsync() (ostream::flush) writes the buffered tail and applies the durability policy: call it before
+    // acknowledging the last block.
+    class DirectFileBuf final : public std::streambuf
+    {
+    public:
+        static constexpr std::size_t ALIGNMENT = 4096;
+        static constexpr std::size_t BUFFER_SIZE = 1024 * 1024;
+
+        DirectFileBuf() = default;
+        ~DirectFileBuf() override;
+        DirectFileBuf(DirectFileBuf const&) = delete;
+        DirectFileBuf& operator=(DirectFileBuf const&) = delete;
+
+        // Create or truncate path, return 0 on success, -error_code otherwise
+        // direct: bypass the page cache (O_DIRECT), the buffering and durability policy apply in both modes
+        int open(char const* path, bool direct = true, Durability durability = Durability::NONE, int64_t sync_interval = 0);
+        int close();
+        bool isDirect() const { return is_direct_; }
+
+    protected:
+        std::streamsize xsputn(char const* data, std::streamsize size) override;
+        int_type overflow(int_type c) override;
+        int sync() override;
+
+    private:
+        int writeBuffer(bool is_final);
+
+        int fd_{-1};
+        bool is_direct_{false};
+        Durability durability_{Durability::NONE};
+        int64_t sync_interval_{0};
+        int64_t offset_{0};         //< file offset of the buffer (aligned)
+        int64_t unsynced_{0};       //< bytes written since the last fdatasync
+        char* buffer_{nullptr};
+        int node_{0};               //< NUMA node of the pool of buffer_
+    };
+}
+
+#endif
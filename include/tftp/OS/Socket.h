@@ -13,15 +13,43 @@ namespace tftp
     public:
         Socket();
         Socket(const char* address, int port);
+        Socket(Socket&& other);
+        Socket& operator=(Socket&& other);
+        Socket(Socket const&) = delete;
+        Socket& operator=(Socket const&) = delete;
         virtual ~Socket();
 
-        void setTimeout(std::chrono::seconds timeout) override;
+        void setTimeout(std::chrono::milliseconds timeout) override;
         int read(void* data, size_t size) override;
         int write(void const* data, size_t size) override;
 
-        int bind(char const* address, char const* port);
+        int bind(char const* address, char const* port, bool reuse_port = false);
         Socket createSocket();
         void switchToLast();
+        std::string targetAddress() const;  //< printable address of the target (without port)
+        std::string lastTid() const;        //< transfer identifier (address and port) of the last received packet
+
+        int pathMtu() const;                //< MTU of the path to the target, -1 if unknown
+        int maxDatagramPayload() const;     //< biggest UDP payload that reaches the target without IP fragmentation
+
+        // Kernel send/receive buffers to hold a whole window, of at most max_size bytes. force: beyond
+        // net.core.[rw]mem_max (needs CAP_NET_ADMIN)
+        void setBufferSize(int64_t size, int64_t max_size, bool force = false);
+
+        // In a SO_REUSEPORT group, deliver each datagram to the socket of the CPU that received it: the Nth bound
+        // socket for cpus[N]. Other CPUs are spread modulo the group size.
+        int steerByCpu(std::vector<int> const& cpus);
+
+        // Spin up to budget on non-blocking receives (and let the kernel busy poll the NIC queue, SO_BUSY_POLL)
+        // before blocking: trade a core for the wakeup latency. 0 disables it.
+        void setBusyPoll(std::chrono::microseconds budget);
+        int incomingCpu() const;            //< CPU that received the last packet, -1 if unknown
+
+        // Multicast (RFC 2090): receive the datagrams sent to the group on port (shared by the local clients)
+        int joinGroup(char const* address, int port);
+
+        // Index of a socket with a datagram to read, -1 on timeout
+        static int waitReadable(std::vector<Socket const*> const& sockets, std::chrono::milliseconds timeout);
 
         using AbstractSocket::read;
         using AbstractSocket::write;
@@ -31,6 +59,7 @@ namespace tftp
         struct sockaddr_in6 target_client_{};
         struct sockaddr_in6 last_client_{};
         socklen_t client_size_;
+        std::chrono::microseconds busy_poll_{0};
     };
 }
 
@@ -0,0 +1,19 @@
+#ifndef TFTP_OS_LINUX_THREAD_H
+#define TFTP_OS_LINUX_THREAD_H
+
+#include <vector>
+
+namespace tftp
+{
+    // Pin the calling thread on a CPU, return 0 on success, -1 otherwise
+    // Memory first touched by the thread afterwards is allocated on the NUMA node of this CPU.
+    int pinThread(int cpu);
+
+    // CPUs the process is allowed to run on
+    std::vector<int> allowedCpus();
+
+    // NUMA node of the CPU running the calling thread, 0 if unknown
+    int currentNode();
+}
+
+#endif
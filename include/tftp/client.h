@@ -0,0 +1,86 @@
+#ifndef TFTP_CLIENT_H
+#define TFTP_CLIENT_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tftp/digest.h"
+#include "tftp/protocol.h"
+
+namespace tftp
+{
+    class Socket;
+
+    struct ClientConfig
+    {
+        std::string server{"::1"};
+        int port{69};
+
+        int max_concurrency{8};                     //< transfers running at the same time (one TID each)
+        int64_t window_size{32};
+        int64_t block_size{0};                      //< 0: largest block size that avoids IP fragmentation
+        std::chrono::milliseconds timeout{5000};
+        std::chrono::microseconds busy_poll{0};     //< spin budget before blocking on a receive, 0: disabled
+        int64_t max_socket_buffer{4 * 1024 * 1024}; //< cap of the kernel buffers sized for the window
+        bool force_socket_buffer{false};            //< beyond net.core.[rw]mem_max (needs CAP_NET_ADMIN)
+        DigestType digest{DigestType::NONE};        //< computed over the content sent or received
+        bool multicast{false};                      //< ask for multicast downloads (RFC 2090), no digest then
+    };
+
+    struct Job
+    {
+        opcode operation;       //< RRQ (get) or WRQ (put)
+        std::string remote;     //< file name on the server
+        std::string local;      //< path of the local file
+    };
+
+    struct JobResult
+    {
+        int error{0};           //< 0 on success, -error_code otherwise
+        int64_t bytes{0};
+        double seconds{0};
+        std::string digest;     //< hex, empty if ClientConfig::digest is NONE
+        double throughput() const { return (seconds > 0) ? bytes / seconds : 0; }  //< bytes per second
+    };
+
+    struct BatchResult
+    {
+        std::vector<JobResult> jobs;    //< same order as the submitted jobs
+        int failed{0};
+        int64_t bytes{0};
+        double seconds{0};              //< wall clock duration of the whole batch
+        double throughput() const { return (seconds > 0) ? bytes / seconds : 0; }  //< bytes per second
+    };
+
+    // Run batches of get/put jobs concurrently against one server.
+    // Options accepted by the server for a job are offered as is to the next ones (no renegotiation probe),
+    // and each worker reuses its buffers across its jobs.
+    class Client
+    {
+    public:
+        Client(ClientConfig const& config);
+
+        BatchResult run(std::vector<Job> const& jobs);
+        JobResult transfer(Job const& job);
+
+    private:
+        struct Buffers
+        {
+            std::vector<char> packet;
+            std::vector<char> file;
+        };
+
+        JobResult transfer(Job const& job, Buffers& buffers);
+        int negotiate(Request& request, Socket& socket, Buffers& buffers);
+        int receiveMulticast(Request& request, Socket& socket, std::ostream& file, Buffers& buffers, int64_t& bytes);
+
+        ClientConfig config_;
+
+        std::mutex mutex_;
+        int64_t negotiated_block_size_{0};  //< accepted by the server on a previous job, 0 if none yet
+        int64_t negotiated_window_size_{0};
+    };
+}
+
+#endif
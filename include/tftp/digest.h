@@ -0,0 +1,48 @@
+#ifndef TFTP_DIGEST_H
+#define TFTP_DIGEST_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tftp
+{
+    enum class DigestType
+    {
+        NONE,
+        CRC32C,     //< SSE4.2 crc32 instruction when available
+        SHA256      //< SHA-NI instructions when available
+    };
+    char const* toString(DigestType type);
+
+    // Digest computed incrementally over the file content while it is transferred, so that the file does not
+    // have to be read again to be checked. Hardware support is detected at runtime with a portable fallback.
+    class Digest
+    {
+    public:
+        Digest(DigestType type = DigestType::NONE, bool allow_hardware = true);
+
+        void update(void const* data, std::size_t size);
+        std::string hex() const;    //< value of the data received so far (big endian for CRC32C), empty if NONE
+
+        DigestType type() const         { return type_; }
+        bool isAccelerated() const      { return is_accelerated_; }
+        static bool hasHardwareSupport(DigestType type);
+
+    private:
+        void sha256Blocks(uint8_t const* data, std::size_t blocks);
+
+        DigestType type_;
+        bool is_accelerated_;
+
+        uint32_t crc_{0xFFFFFFFF};
+
+        std::array<uint32_t, 8> state_;
+        std::array<uint8_t, 64> pending_;   //< partial SHA-256 block
+        std::size_t pending_size_{0};
+        uint64_t length_{0};
+    };
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef TFTP_LOG_H
+#define TFTP_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+namespace tftp
+{
+    enum class LogLevel : int
+    {
+        DEBUG,      //< per packet events
+        INFO,       //< per session events
+        WARNING,
+        ERROR,
+        NONE
+    };
+
+    // Asynchronous logger: a call site formats its message into a ring buffer owned by the calling thread
+    // (single producer, no lock) and a background thread drains the rings into the output.
+    // Logging never blocks a transfer: when the ring of a thread is full, its messages are dropped and counted.
+    // Messages are truncated to MAX_MESSAGE_SIZE.
+    namespace log
+    {
+        constexpr std::size_t MAX_MESSAGE_SIZE = 248;
+
+        void setLevel(LogLevel level);
+        void setOutput(FILE* output, FILE* error_output = stderr); //< stdout by default, WARNING and above to stderr
+        void flush();                   //< block until every message logged before the call is written
+        uint64_t dropped();             //< messages lost because a ring was full
+
+        extern std::atomic<int> active_level;
+        inline bool isEnabled(LogLevel level)
+        {
+            return static_cast<int>(level) >= active_level.load(std::memory_order_relaxed);
+        }
+
+        void write(LogLevel level, char const* format, ...) __attribute__((format(printf, 2, 3)));
+    }
+}
+
+// Levels below TFTP_LOG_COMPILE_LEVEL are removed at compile time, levels below the active level cost a load and
+// a branch: the arguments are not evaluated.
+#ifndef TFTP_LOG_COMPILE_LEVEL
+    #define TFTP_LOG_COMPILE_LEVEL 0
+#endif
+
+#define TFTP_LOG(level, ...)                                                                                \
+    do                                                                                                      \
+    {                                                                                                       \
+        if ((static_cast<int>(::tftp::LogLevel::level) >= TFTP_LOG_COMPILE_LEVEL)                          \
+            and ::tftp::log::isEnabled(::tftp::LogLevel::level))                                            \
+        {                                                                                                   \
+            ::tftp::log::write(::tftp::LogLevel::level, __VA_ARGS__);                                       \
+        }                                                                                                   \
+    } while (0)
+
+#endif
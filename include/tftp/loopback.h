@@ -0,0 +1,105 @@
+#ifndef TFTP_LOOPBACK_H
+#define TFTP_LOOPBACK_H
+
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <random>
+
+#include "tftp/protocol.h"
+
+namespace tftp
+{
+    // Impairments of one direction of a loopback link. Probabilities are in [0, 1].
+    struct LinkConfig
+    {
+        double loss{0};                                 //< probability to lose a datagram (a fragment if mtu is set)
+        double duplicate{0};                            //< probability to deliver a datagram twice
+        double reorder{0};                              //< probability to hold a datagram back by reorder_delay
+        std::chrono::microseconds latency{0};
+        std::chrono::microseconds reorder_delay{1000};
+        int64_t bandwidth{0};                           //< bytes per second, 0: unlimited
+        int mtu{0};                                     //< datagrams bigger than this are fragmented, 0: never
+        int64_t queue_limit{0};                         //< bytes in flight before tail drop, 0: unlimited
+        uint32_t seed{1};
+    };
+
+    struct LinkStats
+    {
+        uint64_t sent{0};
+        uint64_t delivered{0};
+        uint64_t lost{0};
+        uint64_t duplicated{0};
+        uint64_t reordered{0};
+        uint64_t dropped{0};    //< queue_limit reached
+    };
+
+    // In-process pair of connected sockets running on a virtual clock.
+    // Time only advances when both ends wait for a packet, and then jumps to the next delivery or timeout: a lossy
+    // transfer runs in milliseconds, and since impairments are drawn from seeded generators it is reproducible.
+    // Each end shall be used by a single thread, and closed when this thread stops using it.
+    class Link
+    {
+    public:
+        Link(LinkConfig const& a_to_b = {}, LinkConfig const& b_to_a = {});
+
+        class Endpoint final : public AbstractSocket
+        {
+        public:
+            void setTimeout(std::chrono::milliseconds timeout) override;
+            int read(void* data, size_t size) override;
+            int write(void const* data, size_t size) override;
+            void close();
+
+            using AbstractSocket::read;
+            using AbstractSocket::write;
+
+        private:
+            friend class Link;
+            enum State
+            {
+                RUNNING,
+                WAITING,
+                CLOSED
+            };
+
+            Link* link_;
+            int side_;
+            std::chrono::nanoseconds timeout_{0};       //< 0: wait forever
+            std::chrono::nanoseconds deadline_{0};
+            State state_{RUNNING};
+        };
+
+        Endpoint& a() { return endpoints_[0]; }
+        Endpoint& b() { return endpoints_[1]; }
+
+        std::chrono::nanoseconds now();     //< virtual time elapsed since the link creation
+        LinkStats stats(Endpoint const& sender);
+
+    private:
+        struct Direction
+        {
+            LinkConfig config;
+            std::mt19937 rng;
+            std::chrono::nanoseconds busy_until{0};     //< end of the current serialization (bandwidth)
+            std::multimap<std::chrono::nanoseconds, std::vector<char>> in_flight;
+            int64_t in_flight_bytes{0};
+            LinkStats stats;
+        };
+
+        int read(Endpoint& endpoint, void* data, size_t size);
+        int write(Endpoint& endpoint, void const* data, size_t size);
+        void close(Endpoint& endpoint);
+        bool draw(Direction& direction, double probability);
+        bool advance();
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::chrono::nanoseconds now_{0};
+        std::array<Direction, 2> directions_;    //< indexed by the sending side
+        std::array<Endpoint, 2> endpoints_;
+    };
+}
+
+#endif
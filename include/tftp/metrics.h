@@ -0,0 +1,95 @@
+#ifndef TFTP_METRICS_H
+#define TFTP_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace tftp
+{
+    enum Counter
+    {
+        PACKETS_SENT,
+        BYTES_SENT,
+        PACKETS_RECEIVED,
+        BYTES_RECEIVED,
+        RETRANSMITS,        //< data packets sent again
+        TIMEOUTS,
+        DROPPED,            //< out-of-order data blocks
+        IGNORED,            //< stale packets: duplicated or delayed ACK/DATA
+        ACKS,               //< ACKs acknowledging new blocks
+        ACKED_BLOCKS,       //< blocks acknowledged by these ACKs: ACKED_BLOCKS / ACKS is the achieved window
+        RTT_SAMPLES,
+        RTT_SUM_US,
+        SESSIONS,
+        FAILED_SESSIONS,
+        COUNTER_COUNT
+    };
+
+    using Counters = std::array<uint64_t, COUNTER_COUNT>;
+
+    // Counters accumulated by one thread.
+    // There is a single writer per shard: an update is a relaxed load and store on a cache line that no other
+    // thread writes, readers sum all the shards.
+    struct alignas(64) MetricsShard
+    {
+        void add(Counter counter, uint64_t value)
+        {
+            auto& c = counters[counter];
+            c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters{};
+    };
+
+    // Counters and gauges of one transfer, updated by the thread running it.
+    // Updates are forwarded to the thread shard (if any) so that server totals include running transfers.
+    class SessionMetrics
+    {
+    public:
+        SessionMetrics(MetricsShard* shard = nullptr);
+
+        void add(Counter counter, uint64_t value = 1)
+        {
+            counters_[counter] += value;
+            if (shard_ != nullptr)
+            {
+                shard_->add(counter, value);
+            }
+        }
+
+        void addRtt(std::chrono::microseconds sample);
+
+        uint64_t operator[](Counter counter) const { return counters_[counter]; }
+        Counters const& counters() const           { return counters_; }
+        std::chrono::microseconds srtt() const     { return srtt_; }   //< smoothed RTT (RFC 6298)
+        double window() const;                                          //< average blocks per ACK
+
+    private:
+        MetricsShard* shard_;
+        Counters counters_{};
+        std::chrono::microseconds srtt_{0};
+    };
+
+    // Server-wide totals, one shard per thread
+    class MetricsRegistry
+    {
+    public:
+        MetricsRegistry(int shards);
+
+        MetricsShard& shard(int index) { return shards_[index]; }
+        Counters totals() const;
+
+    private:
+        std::vector<MetricsShard> shards_;
+    };
+
+    char const* toString(Counter counter);
+
+    // Prometheus text exposition format of the counters, metric names are prefixed by 'prefix'
+    std::string toPrometheus(Counters const& counters, char const* prefix = "tftp");
+}
+
+#endif
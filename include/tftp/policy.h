@@ -0,0 +1,74 @@
+#ifndef TFTP_POLICY_H
+#define TFTP_POLICY_H
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tftp/protocol.h"
+
+namespace tftp
+{
+    // Options offered to the clients of a subnet for a class of files
+    struct PolicyRule
+    {
+        std::string subnet{"::/0"};                 //< IPv6 prefix (IPv4 clients: ::ffff:a.b.c.d/104 and longer)
+        std::string file_suffix;                    //< file class, e.g. ".img", empty: any file
+        int64_t max_block_size{BLKSIZE.max};
+        int64_t max_window_size{WINDOWSIZE.max};
+        int64_t timeout{0};                         //< retransmission timeout of the server in seconds, 0: default
+    };
+
+    // Server side limits of the negotiated options.
+    // extractOption only clamps the options to the protocol limits: the first rule matching the client and the
+    // file lowers them, then the socket buffers of the session are reserved from a budget shared by all the
+    // sessions. A session may take at most half of what is left, so the window offered shrinks as the load grows
+    // while a lone client still gets its whole window. One block is always granted.
+    class OptionPolicy
+    {
+    public:
+        // max_socket_buffer: cap of the window given to Socket::setBufferSize
+        OptionPolicy(std::vector<PolicyRule> const& rules, int64_t memory_budget, int64_t max_socket_buffer);
+
+        bool isValid() const { return is_valid_; }     //< false if a subnet cannot be parsed
+        int64_t reserved() const { return reserved_; } //< bytes of socket buffers of the running sessions
+        uint64_t shrunk() const { return shrunk_; }    //< sessions offered a smaller window to fit in the budget
+
+        // Options of one session, its socket buffers are reserved until destruction
+        class Grant
+        {
+        public:
+            Grant(OptionPolicy& policy, std::string const& client, Request& request);
+            ~Grant();
+            Grant(Grant const&) = delete;
+            Grant& operator=(Grant const&) = delete;
+
+        private:
+            OptionPolicy& policy_;
+            int64_t bytes_{0};
+        };
+
+    private:
+        struct Rule
+        {
+            std::array<uint8_t, 16> prefix;
+            int length;
+            PolicyRule limits;
+        };
+
+        PolicyRule const* match(std::string const& client, std::string const& filename) const;
+
+        std::vector<Rule> rules_;
+        bool is_valid_{true};
+        int64_t memory_budget_;
+        int64_t max_socket_buffer_;
+
+        std::mutex mutex_;
+        std::atomic<int64_t> reserved_{0};
+        std::atomic<uint64_t> shrunk_{0};
+    };
+}
+
+#endif
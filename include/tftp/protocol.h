@@ -9,6 +9,8 @@
 
 namespace tftp
 {
+    struct Session;
+
     constexpr int MAX_RETRY = 5;
 
     enum opcode : uint16_t
@@ -38,7 +40,9 @@ namespace tftp
         CUSTOM_CODE_SECTION = 0x100,
         RETRY_EXCEEDED      = 0x101,
         IO                  = 0x102,
-        SOCKET_UNUSABLE     = 0x103
+        SOCKET_UNUSABLE     = 0x103,
+        SERVER_BUSY         = 0x104,
+        PEER_ERROR          = 0x105
     };
     constexpr char const* toString(enum error_code code)
     {
@@ -54,6 +58,8 @@ namespace tftp
             case RETRY_EXCEEDED:        { return "Retry exceeded";                   }
             case IO:                    { return "I/O error";                        }
             case SOCKET_UNUSABLE:       { return "Socket unusable";                  }
+            case SERVER_BUSY:           { return "Server busy, retry later";         }
+            case PEER_ERROR:            { return "Error received from peer";         }
             default:                    { return "unknown";                          }
         }
     }
@@ -90,6 +96,21 @@ namespace tftp
     constexpr Option TIMEOUT    = {"timeout",     1,     1, 5, 255        };
     constexpr Option TSIZE      = {"tsize",       0,     0, 0, INT64_MAX  };
 
+    // RFC 2090 multicast read: the client asks for it with an empty value, the server answers "address,port,mc" in
+    // the OACK. Only the master client (mc = 1) ACKs, the server designates a new master with another OACK.
+    // Block numbers wrap around on files of more than 65535 blocks: the server then appends the absolute block the
+    // stream goes on from, in the OACK of a joining client and in an OACK sent to the group before a jump.
+    struct Multicast
+    {
+        static constexpr char const* NAME = "multicast";
+
+        bool is_enable{false};
+        std::string address;    //< group, kept when the OACK omits it (master change)
+        int port{0};
+        bool is_master{false};
+        int64_t position{0};    //< 0: not sent
+    };
+
     struct Request
     {
         uint16_t operation{ILLEGAL};
@@ -100,7 +121,11 @@ namespace tftp
         Option window_size  {WINDOWSIZE};
         Option timeout      {TIMEOUT};
         Option transfer_size{TSIZE};
-        std::array<Option*, 2> supported_options = { &block_size, &window_size };
+        Multicast multicast;
+
+        // Built on each call: a copy of the request shall not point to the options of the original
+        std::array<Option*, 3> supportedOptions() { return { &block_size, &window_size, &transfer_size }; }
+        std::array<Option const*, 3> supportedOptions() const { return { &block_size, &window_size, &transfer_size }; }
     };
 
     class AbstractSocket
@@ -116,7 +141,7 @@ namespace tftp
             return write(packet.data(), packet.size());
         }
 
-        virtual void setTimeout(std::chrono::seconds timeout) = 0;
+        virtual void setTimeout(std::chrono::milliseconds timeout) = 0;
         virtual int read(void* data, size_t size) = 0;
         virtual int write(void const* data, size_t size) = 0;
     };
@@ -165,6 +190,7 @@ namespace tftp
     std::vector<char> forgeOptionAck(Request const& request);
 
     bool isLastDataPacket(size_t size, Request const& request); //< size of the whole packet
+    int64_t maxBlockSize(int datagram_payload); //< biggest block size that fits in the datagram payload
     int parseData(char const* data, size_t size);
     std::vector<char> forgeData(Request const& request, int block, std::istream& input);
 
@@ -175,8 +201,11 @@ namespace tftp
     std::vector<char> forgeError(enum error_code code);
 
     // read and writes functions that can be used for both server and client
-    void processRead(Request const& request, AbstractSocket& socket, std::istream& file);
-    void processWrite(Request const& request, AbstractSocket& socket, std::ostream& file);
+    // return 0 on success, -error_code otherwise
+    int processRead(Request const& request, AbstractSocket& socket, std::istream& file);
+    int processWrite(Request const& request, AbstractSocket& socket, std::ostream& file);
+    int processRead(Request const& request, AbstractSocket& socket, std::istream& file, Session& session);
+    int processWrite(Request const& request, AbstractSocket& socket, std::ostream& file, Session& session);
 }
 
 #endif
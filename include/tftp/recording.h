@@ -0,0 +1,60 @@
+#ifndef TFTP_RECORDING_H
+#define TFTP_RECORDING_H
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "tftp/protocol.h"
+
+namespace tftp
+{
+    enum class RecordType : uint8_t
+    {
+        REQUEST,        //< request that opened the session (received by the listener)
+        RECEIVED,       //< packet of the client
+        SENT,           //< packet of the server
+        READ_TIMEOUT    //< read without answer
+    };
+
+    struct Record
+    {
+        RecordType type;
+        std::chrono::microseconds time;     //< since the session start
+        uint32_t size;                      //< size of the packet on the wire
+        std::vector<char> data;             //< DATA packets: header only (the payload is not needed to replay)
+    };
+
+    // Socket decorator logging the timestamped packets of one session to a compact binary stream: opcode and
+    // block number of DATA packets, other packets in full, with varint timestamps and sizes (an ACK takes 7 bytes).
+    class RecordingSocket final : public AbstractSocket
+    {
+    public:
+        // Timestamps are relative to begin, the reception of the request
+        RecordingSocket(AbstractSocket& socket, std::ostream& output,
+                        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now());
+
+        void recordRequest(std::vector<char> const& packet);   //< at the begin time
+
+        void setTimeout(std::chrono::milliseconds timeout) override;
+        int read(void* data, size_t size) override;
+        int write(void const* data, size_t size) override;
+
+        using AbstractSocket::read;
+        using AbstractSocket::write;
+
+    private:
+        void record(RecordType type, void const* data, size_t size,
+                    std::chrono::steady_clock::time_point when = std::chrono::steady_clock::now());
+
+        AbstractSocket& socket_;
+        std::ostream& output_;
+        std::chrono::steady_clock::time_point begin_;
+        std::chrono::microseconds last_{0};
+    };
+
+    // Read back a session written by a RecordingSocket, return 0 on success, -1 if the stream is not a recording
+    int readRecording(std::istream& input, std::vector<Record>& records);
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef TFTP_SCHEDULER_H
+#define TFTP_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace tftp
+{
+    // Hands out send credits (bytes) to the active sessions.
+    // Credits come from token buckets: a global one (link rate cap) and one per client (client rate cap).
+    // When sessions compete for the global bucket, credits are granted in start-time fair queuing order:
+    // a session that just started (small boot file) is served before a session that already sent a lot.
+    class Scheduler
+    {
+    public:
+        // rates are in bytes per second, 0 means unlimited
+        Scheduler(int64_t global_rate = 0, int64_t client_rate = 0);
+
+        // Sending side of one session
+        class Flow
+        {
+        public:
+            Flow(Scheduler& scheduler, std::string const& client);
+            ~Flow();
+            Flow(Flow const&) = delete;
+            Flow& operator=(Flow const&) = delete;
+
+            // Block until the session is allowed to send bytes
+            void acquire(int64_t bytes);
+
+        private:
+            friend class Scheduler;
+            Scheduler& scheduler_;
+            std::string client_;
+            double finish_tag_{0};
+        };
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct Bucket
+        {
+            int64_t rate;
+            double tokens;
+            double burst;
+            clock::time_point last_refill;
+            int users{0};
+
+            void refill(clock::time_point now);
+            clock::time_point nextCredit(clock::time_point now) const;
+        };
+
+        struct Ticket
+        {
+            double start_tag;
+            uint64_t sequence;
+            Bucket* client;
+            bool operator<(Ticket const& other) const
+            {
+                if (start_tag != other.start_tag)
+                {
+                    return start_tag < other.start_tag;
+                }
+                return sequence < other.sequence;
+            }
+        };
+
+        void acquire(Flow& flow, int64_t bytes);
+        void attach(Flow& flow);
+        void detach(Flow& flow);
+
+        bool is_limited_;
+        int64_t client_rate_;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        Bucket global_;
+        std::map<std::string, Bucket> clients_;
+        std::set<Ticket> waiting_;
+        double virtual_time_{0};
+        uint64_t sequence_{0};
+    };
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef TFTP_SERVER_H
+#define TFTP_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "tftp/digest.h"
+#include "tftp/metrics.h"
+#include "tftp/policy.h"
+#include "tftp/protocol.h"
+#include "tftp/scheduler.h"
+#include "tftp/OS/File.h"
+#include "tftp/OS/Socket.h"
+
+namespace tftp
+{
+    // Outcome of a served transfer
+    struct TransferReport
+    {
+        opcode operation;
+        std::string filename;
+        int error;              //< 0 on success, -error_code otherwise
+        std::string digest;     //< of the content transferred, empty if ServerConfig::digest is NONE
+    };
+
+    struct ServerConfig
+    {
+        char const* address{"::"};
+        char const* port{"69"};
+
+        int max_sessions{64};       //< concurrent transfers (one worker thread each)
+        int max_pending{256};       //< accepted requests waiting for a worker, more are rejected
+
+        int64_t global_rate{0};     //< bytes per second, 0: unlimited
+        int64_t client_rate{0};     //< bytes per second, 0: unlimited
+
+        char const* trace_directory{nullptr};   //< write a Chrome trace per session (TFTP_TRACING builds only)
+        char const* record_directory{nullptr};  //< write the packets of each session to replay them (tftp_replay)
+
+        // One shard per CPU: a listener and max_sessions / cpus.size() workers pinned on it. Requests are steered
+        // to the shard of the CPU that received them. Only requests are: a transfer socket has its own ephemeral
+        // port, the NIC (RSS/RPS) picks the CPU of its packets (see ServerStats::remote_sessions).
+        // Empty: one shard, threads are not pinned.
+        std::vector<int> cpus;
+
+        std::chrono::microseconds busy_poll{0}; //< spin budget of the transfer sockets before blocking, 0: disabled
+
+        // Kernel buffers of a transfer socket hold its window (chosen by the client) up to max_socket_buffer bytes.
+        // force_socket_buffer goes beyond net.core.[rw]mem_max (needs CAP_NET_ADMIN).
+        int64_t max_socket_buffer{4 * 1024 * 1024};
+        bool force_socket_buffer{false};
+
+        // Uploads: O_DIRECT writes keep the page cache for the served files, durability decides when the final
+        // ACK is sent
+        bool direct_io{false};
+        Durability durability{Durability::NONE};
+        int64_t sync_interval{64 * 1024 * 1024};    //< bytes between two syncs (PERIODIC)
+
+        // Digest of the content computed while it is transferred (no second read of the file to check it)
+        DigestType digest{DigestType::NONE};
+        std::function<void(TransferReport const&)> on_transfer;    //< called by the worker at the end of a transfer
+
+        // Multicast downloads (RFC 2090): concurrent reads of a file share one stream sent to the group, on a
+        // port per stream from multicast_port. nullptr: the option is not negotiated.
+        char const* multicast_address{nullptr};
+        int multicast_port{1758};
+
+        // Options offered per client subnet and file class (first matching rule), and bytes of socket buffers
+        // shared by the sessions (0: unlimited): new sessions get smaller windows as the budget fills up
+        std::vector<PolicyRule> policy;
+        int64_t memory_budget{256 * 1024 * 1024};
+    };
+
+    struct ServerStats
+    {
+        int64_t active_sessions;
+        int64_t pending_sessions;   //< queue depth
+        uint64_t accepted;
+        uint64_t rejected;          //< overload: ERROR sent instead of serving
+        uint64_t duplicates;        //< retransmitted requests of a pending or active session
+        uint64_t invalid;           //< malformed requests
+        uint64_t remote_sessions;   //< pinned sessions whose packets were received by another CPU
+        uint64_t multicast_joins;   //< downloads served by the multicast stream of another client
+        int64_t reserved_memory;    //< socket buffers of the running sessions (ServerConfig::memory_budget)
+        uint64_t shrunk_windows;    //< sessions offered a smaller window to fit in the memory budget
+    };
+
+    // Listen for requests and serve them with a pool of workers.
+    // Admission control: at most max_sessions transfers run concurrently and max_pending requests wait for a
+    // worker. Beyond that, the request is rejected right away with an ERROR so that the client does not wait
+    // for a timeout.
+    class Server
+    {
+    public:
+        Server(ServerConfig const& config);
+        ~Server();
+
+        int start();    //< bind and start the threads, return -1 on failure
+        void stop();    //< pending requests are dropped, active transfers finish
+
+        ServerStats stats() const;
+        Counters metrics() const;       //< transfer counters of all sessions, running ones included
+        std::string prometheus() const; //< stats and metrics in Prometheus text format
+
+    private:
+        struct PendingSession
+        {
+            Request request;
+            Socket socket;
+            std::string tid;
+            std::chrono::steady_clock::time_point received;     //< of the request, the session waits from then
+            std::vector<char> datagram;                         //< request as received, kept to record the session
+        };
+
+        struct Shard
+        {
+            int cpu;                //< -1: not pinned
+            Socket listener;
+            std::thread listener_thread;
+            std::condition_variable cv;
+            std::deque<PendingSession> pending;
+        };
+
+        // Clients of a multicast download: the worker of the first request sends the file to the group, driven
+        // by the ACKs of one master client at a time
+        struct MulticastStream
+        {
+            MulticastStream(Request const& options, int64_t last)
+                : request{options}
+                , last_block{last}
+            {
+            }
+
+            Request request;
+            int64_t last_block;
+            std::atomic<int64_t> position{0};           //< absolute block of the DATA being sent
+            std::deque<PendingSession> listeners;       //< not master yet
+        };
+
+        void listen(Shard& shard);
+        void work(Shard& shard, int index);
+        bool serve(PendingSession& session, MetricsShard& shard);  //< true if a multicast stream took the session over
+        bool joinStream(PendingSession& session);
+        int runStream(PendingSession& session, AbstractSocket& socket, std::istream& file, Session& transfer);
+
+        ServerConfig config_;
+        Scheduler scheduler_;
+        OptionPolicy policy_;
+        MetricsRegistry metrics_;       //< one shard per worker
+
+        std::atomic<bool> is_running_{false};
+        std::vector<std::unique_ptr<Shard>> shards_;
+        std::vector<std::thread> workers_;
+
+        std::mutex mutex_;
+        std::set<std::string> tids_;    //< pending and active sessions
+        std::map<std::string, std::unique_ptr<MulticastStream>> streams_;   //< by filename
+
+        std::atomic<int64_t> active_sessions_{0};
+        std::atomic<int64_t> pending_sessions_{0};
+        std::atomic<uint64_t> accepted_{0};
+        std::atomic<uint64_t> rejected_{0};
+        std::atomic<uint64_t> duplicates_{0};
+        std::atomic<uint64_t> invalid_{0};
+        std::atomic<uint64_t> remote_sessions_{0};
+        std::atomic<uint64_t> multicast_joins_{0};
+        std::atomic<uint64_t> traces_{0};
+        std::atomic<uint64_t> recordings_{0};
+    };
+}
+
+#endif
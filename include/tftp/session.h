@@ -0,0 +1,37 @@
+#ifndef TFTP_SESSION_H
+#define TFTP_SESSION_H
+
+#include <atomic>
+
+#include "tftp/digest.h"
+#include "tftp/metrics.h"
+#include "tftp/scheduler.h"
+#include "tftp/trace.h"
+
+namespace tftp
+{
+    // Optional state of a transfer shared with processRead/processWrite
+    struct Session
+    {
+        Scheduler::Flow* flow{nullptr};    //< send credits, unlimited if null
+        SessionMetrics* metrics{nullptr};  //< not collected if null
+        Tracer* tracer{nullptr};           //< not traced if null (or if compiled without TFTP_TRACING)
+        Digest* digest{nullptr};           //< updated with the file content, in order, if not null
+
+        // Multicast read (RFC 2090): a new master client resumes the transfer from its first missing block, and
+        // may ACK ahead of the window (blocks received before it became the master)
+        bool is_multicast{false};
+        int64_t first_block{1};
+        std::atomic<int64_t>* stream_position{nullptr};  //< multicast: absolute block of the DATA being sent
+
+        void count(Counter counter, uint64_t value = 1)
+        {
+            if (metrics != nullptr)
+            {
+                metrics->add(counter, value);
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef TFTP_TRACE_H
+#define TFTP_TRACE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace tftp
+{
+    // Log-linear histogram (HDR-style): each power of two is split in 16 linear sub-buckets, so a recorded value
+    // is known within 6.25% on the whole uint64 range with a fixed array and no allocation.
+    class Histogram
+    {
+    public:
+        void record(uint64_t value);
+        void merge(Histogram const& other);
+
+        uint64_t count() const  { return count_; }
+        uint64_t sum() const    { return sum_; }
+        uint64_t max() const    { return max_; }
+        uint64_t percentile(double percent) const;  //< upper bound of the bucket holding the percentile
+
+    private:
+        static constexpr int SUB_BUCKET_BITS = 4;
+        static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static constexpr int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        static int indexOf(uint64_t value);
+        static uint64_t upperBoundOf(int index);
+
+        std::array<uint64_t, BUCKETS> counts_{};
+        uint64_t count_{0};
+        uint64_t sum_{0};
+        uint64_t max_{0};
+    };
+
+    enum Stage
+    {
+        FILE_READ,
+        FORGE,
+        PACING,         //< waiting for send credits
+        SEND,           //< send syscall
+        RECEIVE,        //< receive syscall (blocking until a packet or the timeout)
+        WAIT_ACK,       //< from the end of a window to its ACK
+        FILE_WRITE,
+        DIGEST,
+        STAGE_COUNT
+    };
+    char const* toString(Stage stage);
+
+    // Where the time of one transfer goes: a histogram (nanoseconds) per stage and, optionally, the list of the
+    // timed events to be exported in Chrome trace format (chrome://tracing, ui.perfetto.dev).
+    // Instrumentation points only exist when the library is compiled with TFTP_TRACING.
+    class Tracer
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        Tracer(bool record_events = false, std::size_t max_events = 1 << 20);
+
+        void add(Stage stage, clock::time_point begin, clock::time_point end);
+
+        Histogram const& histogram(Stage stage) const { return histograms_[stage]; }
+        uint64_t droppedEvents() const                { return dropped_events_; }
+
+        std::string summary() const;    //< one line per traced stage
+        void writeChromeTrace(std::ostream& output, int pid = 1, int tid = 1) const;
+
+        // Tracer of the transfer running on the calling thread, null if none
+        static Tracer* current();
+
+    private:
+        struct Event
+        {
+            Stage stage;
+            clock::time_point begin;
+            clock::duration duration;
+        };
+
+        clock::time_point origin_;
+        bool record_events_;
+        std::size_t max_events_;
+        std::array<Histogram, STAGE_COUNT> histograms_{};
+        std::vector<Event> events_;
+        uint64_t dropped_events_{0};
+    };
+
+    // Make a tracer current on the calling thread for its lifetime
+    class TraceContext
+    {
+    public:
+        TraceContext(Tracer* tracer);
+        ~TraceContext();
+        TraceContext(TraceContext const&) = delete;
+        TraceContext& operator=(TraceContext const&) = delete;
+
+    private:
+        Tracer* previous_;
+    };
+
+    // Time the enclosing scope into the current tracer
+    class TraceSpan
+    {
+    public:
+        TraceSpan(Stage stage)
+            : tracer_{Tracer::current()}
+            , stage_{stage}
+        {
+            if (tracer_ != nullptr)
+            {
+                begin_ = Tracer::clock::now();
+            }
+        }
+
+        ~TraceSpan()
+        {
+            if (tracer_ != nullptr)
+            {
+                tracer_->add(stage_, begin_, Tracer::clock::now());
+            }
+        }
+
+        TraceSpan(TraceSpan const&) = delete;
+        TraceSpan& operator=(TraceSpan const&) = delete;
+
+    private:
+        Tracer* tracer_;
+        Stage stage_;
+        Tracer::clock::time_point begin_;
+    };
+}
+
+#define TFTP_TRACE_CONCAT_(a, b) a##b
+#define TFTP_TRACE_CONCAT(a, b) TFTP_TRACE_CONCAT_(a, b)
+
+#ifdef TFTP_TRACING
+    #define TFTP_TRACE(stage)           ::tftp::TraceSpan TFTP_TRACE_CONCAT(trace_span_, __LINE__)(::tftp::stage)
+    #define TFTP_TRACE_SESSION(tracer)  ::tftp::TraceContext TFTP_TRACE_CONCAT(trace_context_, __LINE__)(tracer)
+#else
+    #define TFTP_TRACE(stage)
+    #define TFTP_TRACE_SESSION(tracer)
+#endif
+
+#endif
@@ -0,0 +1,342 @@
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+#include "OS/File.h"
+#include "OS/Thread.h"
+
+namespace tftp
+{
+    namespace
+    {
+        // Aligned buffers of the upload sinks, kept for the next sessions
+        class BufferPool
+        {
+        public:
+            ~BufferPool()
+            {
+                for (char* buffer : free_)
+                {
+                    std::free(buffer);
+                }
+            }
+
+            char* acquire()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (not free_.empty())
+                    {
+                        char* buffer = free_.back();
+                        free_.pop_back();
+                        return buffer;
+                    }
+                }
+
+                void* buffer = nullptr;
+                if (posix_memalign(&buffer, DirectFileBuf::ALIGNMENT, DirectFileBuf::BUFFER_SIZE) != 0)
+                {
+                    return nullptr;
+                }
+                return static_cast<char*>(buffer);
+            }
+
+            void release(char* buffer)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (free_.size() < MAX_FREE_BUFFERS)
+                {
+                    free_.push_back(buffer);
+                    return;
+                }
+                std::free(buffer);
+            }
+
+        private:
+            static constexpr std::size_t MAX_FREE_BUFFERS = 64;
+
+            std::mutex mutex_;
+            std::vector<char*> free_;
+        };
+
+        // One pool per NUMA node: the buffers are first touched by the pinned worker that allocates them, so they
+        // are only reused by the sessions of the same node
+        constexpr int MAX_NODES = 64;
+
+        BufferPool& bufferPool(int node)
+        {
+            static std::array<BufferPool, MAX_NODES> pools;
+            return pools[node % MAX_NODES];
+        }
+
+        int64_t alignDown(int64_t value)
+        {
+            return value & ~static_cast<int64_t>(DirectFileBuf::ALIGNMENT - 1);
+        }
+
+        int64_t alignUp(int64_t value)
+        {
+            return alignDown(value + DirectFileBuf::ALIGNMENT - 1);
+        }
+    }
+
+
+    int64_t fileSize(char const* path)
+    {
+        struct stat stat_buf;
+        if (stat(path, &stat_buf) < 0)
+        {
+            return -1;
+        }
+        return stat_buf.st_size;
+    }
+
+
+    int checkFreeSpace(char const* path, int64_t size)
+    {
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        if (directory.empty())
+        {
+            directory = ".";
+        }
+
+        struct statvfs vfs;
+        if (statvfs(directory.c_str(), &vfs) < 0)
+        {
+            return -error_code::ACCESS_VIOLATION;
+        }
+        int64_t available = static_cast<int64_t>(vfs.f_bavail) * vfs.f_frsize;
+
+        // The existing file will be truncated: its blocks are available for the upload
+        struct stat stat_buf;
+        if (stat(path, &stat_buf) == 0)
+        {
+            available += static_cast<int64_t>(stat_buf.st_blocks) * 512;
+        }
+
+        if (available < size)
+        {
+            return -error_code::NO_MEMORY;
+        }
+        return 0;
+    }
+
+
+    int preallocate(char const* path, int64_t size)
+    {
+        if (size <= 0)
+        {
+            return 0;
+        }
+
+        int fd = ::open(path, O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return -error_code::ACCESS_VIOLATION;
+        }
+
+        // Keep the size unchanged: the file grows with the received data, extents are already allocated
+        int ret = 0;
+        if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) < 0)
+        {
+            switch (errno)
+            {
+                case ENOSPC:     { ret = -error_code::NO_MEMORY; break; }
+                case EOPNOTSUPP: { ret = 0;                      break; }   // best effort
+                default:         { ret = -error_code::IO;        break; }
+            }
+        }
+
+        ::close(fd);
+        return ret;
+    }
+
+
+    DirectFileBuf::~DirectFileBuf()
+    {
+        close();
+    }
+
+
+    int DirectFileBuf::open(char const* path, bool direct, Durability durability, int64_t sync_interval)
+    {
+        close();
+
+        is_direct_ = direct;
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        fd_ = ::open(path, flags | (direct ? O_DIRECT : 0), 0644);
+        if ((fd_ < 0) and direct and (errno == EINVAL))
+        {
+            // tmpfs and some network filesystems
+            is_direct_ = false;
+            fd_ = ::open(path, flags, 0644);
+        }
+        if (fd_ < 0)
+        {
+            return -error_code::ACCESS_VIOLATION;
+        }
+
+        node_ = currentNode();
+        buffer_ = bufferPool(node_).acquire();
+        if (buffer_ == nullptr)
+        {
+            ::close(fd_);
+            fd_ = -1;
+            return -error_code::NO_MEMORY;
+        }
+
+        durability_ = durability;
+        sync_interval_ = sync_interval;
+        offset_ = 0;
+        unsynced_ = 0;
+        setp(buffer_, buffer_ + BUFFER_SIZE);
+        return 0;
+    }
+
+
+    int DirectFileBuf::close()
+    {
+        if (fd_ < 0)
+        {
+            return 0;
+        }
+
+        int ret = sync();
+        ::close(fd_);
+        fd_ = -1;
+        bufferPool(node_).release(buffer_);
+        buffer_ = nullptr;
+        setp(nullptr, nullptr);
+        return ret;
+    }
+
+
+    int DirectFileBuf::writeBuffer(bool is_final)
+    {
+        // O_DIRECT writes whole aligned blocks: the unaligned tail stays in the buffer, unless this is the final
+        // write where it is padded and the file truncated to its real size
+        int64_t size = pptr() - pbase();
+        int64_t aligned = alignDown(size);
+        int64_t to_write = aligned;
+        if (is_final)
+        {
+            to_write = alignUp(size);
+            std::memset(buffer_ + size, 0, to_write - size);
+        }
+
+        for (int64_t written = 0; written < to_write; )
+        {
+            ssize_t ret = pwrite(fd_, buffer_ + written, to_write - written, offset_ + written);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return -1;
+            }
+            written += ret;
+        }
+
+        if (is_final and (ftruncate(fd_, offset_ + size) < 0))
+        {
+            return -1;
+        }
+
+        unsynced_ += to_write;
+        if ((durability_ == Durability::PERIODIC) and (unsynced_ >= sync_interval_))
+        {
+            if (fdatasync(fd_) < 0)
+            {
+                return -1;
+            }
+            unsynced_ = 0;
+        }
+
+        // Keep the tail at the beginning of the buffer, its file offset is aligned
+        int64_t tail = size - aligned;
+        std::memmove(buffer_, buffer_ + aligned, tail);
+        offset_ += aligned;
+        setp(buffer_, buffer_ + BUFFER_SIZE);
+        pbump(static_cast<int>(tail));
+        return 0;
+    }
+
+
+    std::streamsize DirectFileBuf::xsputn(char const* data, std::streamsize size)
+    {
+        if (fd_ < 0)
+        {
+            return 0;
+        }
+
+        std::streamsize copied = 0;
+        while (copied < size)
+        {
+            std::streamsize room = epptr() - pptr();
+            if (room == 0)
+            {
+                if (writeBuffer(false) < 0)
+                {
+                    return copied;
+                }
+                continue;
+            }
+
+            std::streamsize chunk = std::min(room, size - copied);
+            std::memcpy(pptr(), data + copied, chunk);
+            pbump(static_cast<int>(chunk));
+            copied += chunk;
+        }
+        return copied;
+    }
+
+
+    DirectFileBuf::int_type DirectFileBuf::overflow(int_type c)
+    {
+        if ((fd_ < 0) or (writeBuffer(false) < 0))
+        {
+            return traits_type::eof();
+        }
+
+        if (not traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+
+    int DirectFileBuf::sync()
+    {
+        if (fd_ < 0)
+        {
+            return -1;
+        }
+
+        if (writeBuffer(true) < 0)
+        {
+            return -1;
+        }
+
+        if ((durability_ != Durability::NONE) and (unsynced_ > 0))
+        {
+            if (fdatasync(fd_) < 0)
+            {
+                return -1;
+            }
+            unsynced_ = 0;
+        }
+        return 0;
+    }
+}
@@ -1,8 +1,14 @@
+#include <linux/filter.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 
 #include "OS/Socket.h"
+#include "log.h"
+#include "trace.h"
 
 namespace tftp
 {
@@ -25,20 +31,48 @@ namespace tftp
         target_client_.sin6_port = hton(uint16_t(port));
         if (inet_pton(AF_INET6, address, &target_client_.sin6_addr) != 1)
         {
-            perror("deducing IPv6 address");
+            TFTP_LOG(ERROR, "deducing IPv6 address: %s\n", strerror(errno));
         }
     }
 
+    Socket::Socket(Socket&& other)
+        : fd_{other.fd_}
+        , target_client_{other.target_client_}
+        , last_client_{other.last_client_}
+        , client_size_{other.client_size_}
+        , busy_poll_{other.busy_poll_}
+    {
+        other.fd_ = -1;
+    }
+
+    Socket& Socket::operator=(Socket&& other)
+    {
+        if (this != &other)
+        {
+            ::close(fd_);
+            fd_ = other.fd_;
+            target_client_ = other.target_client_;
+            last_client_ = other.last_client_;
+            client_size_ = other.client_size_;
+            busy_poll_ = other.busy_poll_;
+            other.fd_ = -1;
+        }
+        return *this;
+    }
+
     Socket::~Socket()
     {
-        ::close(fd_);
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
     }
 
-    void Socket::setTimeout(std::chrono::seconds timeout)
+    void Socket::setTimeout(std::chrono::milliseconds timeout)
     {
         struct timeval posix_timeout;
-        posix_timeout.tv_sec  = timeout.count();
-        posix_timeout.tv_usec = 0;
+        posix_timeout.tv_sec  = timeout.count() / 1000;
+        posix_timeout.tv_usec = (timeout.count() % 1000) * 1000;
         if (setsockopt (fd_, SOL_SOCKET, SO_RCVTIMEO, &posix_timeout, sizeof(struct timeval)) < 0)
         {
             throw error_code::SOCKET_UNUSABLE;
@@ -47,16 +81,37 @@ namespace tftp
 
     int Socket::read(void* data, size_t size)
     {
+        TFTP_TRACE(RECEIVE);
+        if (busy_poll_.count() > 0)
+        {
+            auto deadline = std::chrono::steady_clock::now() + busy_poll_;
+            do
+            {
+                int rec = recvfrom(fd_, data, size, MSG_DONTWAIT, (struct sockaddr*)&last_client_, &client_size_);
+                if ((rec >= 0) or ((errno != EAGAIN) and (errno != EWOULDBLOCK)))
+                {
+                    return rec;
+                }
+            } while (std::chrono::steady_clock::now() < deadline);
+        }
         return recvfrom(fd_, data, size, 0, (struct sockaddr*)&last_client_, &client_size_);
     }
 
     int Socket::write(void const* data, size_t size)
     {
+        TFTP_TRACE(SEND);
         return sendto(fd_, data, size, 0, (struct sockaddr*)&target_client_, client_size_);
     }
 
-    int Socket::bind(char const* address, char const* port)
+    int Socket::bind(char const* address, char const* port, bool reuse_port)
     {
+        int enable = 1;
+        if (reuse_port and (setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0))
+        {
+            TFTP_LOG(ERROR, "SO_REUSEPORT: %s\n", strerror(errno));
+            return -1;
+        }
+
         struct addrinfo hints;
         struct addrinfo* result;
         struct addrinfo* rp;
@@ -73,7 +128,7 @@ namespace tftp
         int res = getaddrinfo(address, port, &hints, &result);
         if (res != 0)
         {
-            fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(res));
+            TFTP_LOG(ERROR, "getaddrinfo: %s\n", gai_strerror(res));
             return -1;
         }
 
@@ -89,7 +144,7 @@ namespace tftp
         if (rp == nullptr)
         {
             // No solution for bind
-            fprintf(stderr, "Could not bind\n");
+            TFTP_LOG(ERROR, "Could not bind\n");
             return -1;
         }
 
@@ -103,16 +158,224 @@ namespace tftp
         Socket s;
         s.target_client_ = last_client_;
 
-        char str[INET6_ADDRSTRLEN];
-        inet_ntop(AF_INET6, &(s.target_client_), str, INET6_ADDRSTRLEN);
+        // The transfer socket only talks to this client: filter other TIDs and cache the route (and its MTU)
+        if (::connect(s.fd_, (struct sockaddr*)&s.target_client_, sizeof(s.target_client_)) < 0)
+        {
+            TFTP_LOG(ERROR, "connect transfer socket: %s\n", strerror(errno));
+        }
 
-        printf("Creating a new socket to communicate with %s : %d\n", str, s.target_client_.sin6_port);
+        TFTP_LOG(DEBUG, "Creating a new socket to communicate with %s : %d\n", s.targetAddress().c_str(), hton(s.target_client_.sin6_port));
         return s;
     }
 
 
+    std::string Socket::targetAddress() const
+    {
+        char str[INET6_ADDRSTRLEN];
+        if (inet_ntop(AF_INET6, &target_client_.sin6_addr, str, INET6_ADDRSTRLEN) == nullptr)
+        {
+            return {};
+        }
+        return str;
+    }
+
+
+    std::string Socket::lastTid() const
+    {
+        char str[INET6_ADDRSTRLEN];
+        if (inet_ntop(AF_INET6, &last_client_.sin6_addr, str, INET6_ADDRSTRLEN) == nullptr)
+        {
+            return {};
+        }
+        return "[" + std::string(str) + "]:" + std::to_string(hton(last_client_.sin6_port));
+    }
+
+
     void Socket::switchToLast()
     {
         target_client_ = last_client_;
     }
+
+
+    int Socket::pathMtu() const
+    {
+        int mtu;
+        socklen_t len = sizeof(mtu);
+        if (getsockopt(fd_, IPPROTO_IPV6, IPV6_MTU, &mtu, &len) == 0)
+        {
+            return mtu;
+        }
+
+        // Not connected (client side): ask the route of the target through a scratch socket
+        int fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd < 0)
+        {
+            return -1;
+        }
+
+        mtu = -1;
+        len = sizeof(mtu);
+        if ((::connect(fd, (struct sockaddr const*)&target_client_, sizeof(target_client_)) < 0)
+            or (getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &len) < 0))
+        {
+            mtu = -1;
+        }
+        ::close(fd);
+        return mtu;
+    }
+
+
+    int Socket::maxDatagramPayload() const
+    {
+        int mtu = pathMtu();
+        if (mtu < 0)
+        {
+            return -1;
+        }
+
+        constexpr int UDP_HEADER  = 8;
+        constexpr int IPV4_HEADER = 20;
+        constexpr int IPV6_HEADER = 40;
+        int ip_header = IN6_IS_ADDR_V4MAPPED(&target_client_.sin6_addr) ? IPV4_HEADER : IPV6_HEADER;
+        return mtu - ip_header - UDP_HEADER;
+    }
+
+
+    void Socket::setBufferSize(int64_t size, int64_t max_size, bool force)
+    {
+        // Kernel accounts the allocated memory of each datagram, which can be twice its payload
+        size = std::min<int64_t>({size, max_size, INT32_MAX / 2});
+        if (size <= 0)
+        {
+            return;
+        }
+        int value = static_cast<int>(size * 2);
+
+        // best effort: only grow the buffers. The kernel caps the value to net.core.[rw]mem_max unless forced
+        // (CAP_NET_ADMIN)
+        int const options[][2] = { { SO_RCVBUF, SO_RCVBUFFORCE }, { SO_SNDBUF, SO_SNDBUFFORCE } };
+        for (auto const& option : options)
+        {
+            int current;
+            socklen_t len = sizeof(current);
+            if ((getsockopt(fd_, SOL_SOCKET, option[0], &current, &len) == 0) and (current >= value))
+            {
+                continue;
+            }
+            if ((not force) or (setsockopt(fd_, SOL_SOCKET, option[1], &value, sizeof(value)) < 0))
+            {
+                setsockopt(fd_, SOL_SOCKET, option[0], &value, sizeof(value));
+            }
+        }
+    }
+
+
+    int Socket::steerByCpu(std::vector<int> const& cpus)
+    {
+        // A = receiving CPU, return the index of its socket or A % group size
+        std::vector<struct sock_filter> program;
+        program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)));
+        for (std::size_t i = 0; i < cpus.size(); ++i)
+        {
+            program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(cpus[i]), 0, 1));
+            program.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(i)));
+        }
+        program.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(cpus.size())));
+        program.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+
+        struct sock_fprog fprog;
+        fprog.len = static_cast<unsigned short>(program.size());
+        fprog.filter = program.data();
+        if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) < 0)
+        {
+            TFTP_LOG(ERROR, "SO_ATTACH_REUSEPORT_CBPF: %s\n", strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int Socket::incomingCpu() const
+    {
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (getsockopt(fd_, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0)
+        {
+            return -1;
+        }
+        return cpu;
+    }
+
+
+    void Socket::setBusyPoll(std::chrono::microseconds budget)
+    {
+        busy_poll_ = budget;
+
+        // Needs CAP_NET_ADMIN to go above net.core.busy_read: the spin loop works without it
+        int usec = static_cast<int>(budget.count());
+        if (setsockopt(fd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+        {
+            TFTP_LOG(DEBUG, "SO_BUSY_POLL: %s\n", strerror(errno));
+        }
+    }
+
+
+    int Socket::joinGroup(char const* address, int port)
+    {
+        struct ipv6_mreq membership{};
+        if (inet_pton(AF_INET6, address, &membership.ipv6mr_multiaddr) != 1)
+        {
+            TFTP_LOG(ERROR, "multicast group %s: %s\n", address, strerror(errno));
+            return -1;
+        }
+
+        int enable = 1;
+        if (setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0)
+        {
+            TFTP_LOG(ERROR, "SO_REUSEADDR: %s\n", strerror(errno));
+            return -1;
+        }
+
+        // Bound on the group address: only the datagrams of the group are received
+        struct sockaddr_in6 group{};
+        group.sin6_family = AF_INET6;
+        group.sin6_port = hton(uint16_t(port));
+        group.sin6_addr = membership.ipv6mr_multiaddr;
+        if (::bind(fd_, reinterpret_cast<struct sockaddr*>(&group), sizeof(group)) < 0)
+        {
+            TFTP_LOG(ERROR, "bind multicast group: %s\n", strerror(errno));
+            return -1;
+        }
+
+        if (setsockopt(fd_, IPPROTO_IPV6, IPV6_JOIN_GROUP, &membership, sizeof(membership)) < 0)
+        {
+            TFTP_LOG(ERROR, "IPV6_JOIN_GROUP: %s\n", strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int Socket::waitReadable(std::vector<Socket const*> const& sockets, std::chrono::milliseconds timeout)
+    {
+        std::vector<struct pollfd> fds(sockets.size());
+        for (size_t i = 0; i < sockets.size(); ++i)
+        {
+            fds[i].fd = sockets[i]->fd_;
+            fds[i].events = POLLIN;
+        }
+
+        if (poll(fds.data(), fds.size(), static_cast<int>(timeout.count())) <= 0)
+        {
+            return -1;
+        }
+        for (size_t i = 0; i < fds.size(); ++i)
+        {
+            if (fds[i].revents != 0)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
 }
@@ -0,0 +1,52 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "OS/Thread.h"
+
+namespace tftp
+{
+    int pinThread(int cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+
+    std::vector<int> allowedCpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        {
+            return cpus;
+        }
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+
+    int currentNode()
+    {
+        unsigned int cpu = 0;
+        unsigned int node = 0;
+        if (getcpu(&cpu, &node) != 0)
+        {
+            return 0;
+        }
+        return static_cast<int>(node);
+    }
+}
@@ -0,0 +1,442 @@
+#include "client.h"
+#include "log.h"
+#include "session.h"
+#include "OS/Socket.h"
+#include "OS/File.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+namespace tftp
+{
+    namespace
+    {
+        constexpr size_t FILE_BUFFER_SIZE = 1024 * 1024;
+    }
+
+
+    Client::Client(ClientConfig const& config)
+        : config_{config}
+    {
+    }
+
+
+    BatchResult Client::run(std::vector<Job> const& jobs)
+    {
+        BatchResult result;
+        result.jobs.resize(jobs.size());
+
+        std::atomic<size_t> next_job{0};
+        auto worker = [&]()
+        {
+            Buffers buffers;
+            for (size_t i = next_job++; i < jobs.size(); i = next_job++)
+            {
+                result.jobs[i] = transfer(jobs[i], buffers);
+            }
+        };
+
+        auto begin = std::chrono::steady_clock::now();
+
+        size_t concurrency = std::clamp<size_t>(config_.max_concurrency, 1, std::max<size_t>(jobs.size(), 1));
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < concurrency; ++i)
+        {
+            workers.emplace_back(worker);
+        }
+        for (auto& thread : workers)
+        {
+            thread.join();
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        result.seconds = std::chrono::duration<double>(end - begin).count();
+
+        for (auto const& job : result.jobs)
+        {
+            if (job.error != 0)
+            {
+                ++result.failed;
+                continue;
+            }
+            result.bytes += job.bytes;
+        }
+
+        return result;
+    }
+
+
+    JobResult Client::transfer(Job const& job)
+    {
+        Buffers buffers;
+        return transfer(job, buffers);
+    }
+
+
+    JobResult Client::transfer(Job const& job, Buffers& buffers)
+    {
+        JobResult result;
+        auto begin = std::chrono::steady_clock::now();
+
+        Request request;
+        request.operation = job.operation;
+        request.mode = Mode::OCTET;
+        request.filename = job.remote;
+
+        // One socket per job: each transfer has its own TID
+        Socket socket(config_.server.c_str(), config_.port);
+        socket.setTimeout(config_.timeout);
+        if (config_.busy_poll.count() > 0)
+        {
+            socket.setBusyPoll(config_.busy_poll);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (negotiated_block_size_ > 0)
+            {
+                request.block_size.value  = negotiated_block_size_;
+                request.window_size.value = negotiated_window_size_;
+            }
+            else
+            {
+                request.block_size.value  = config_.block_size;
+                if (request.block_size.value <= 0)
+                {
+                    request.block_size.value = maxBlockSize(socket.maxDatagramPayload()); // largest unfragmented block
+                }
+                request.window_size.value = config_.window_size;
+            }
+        }
+        request.block_size.is_enable  = true;
+        request.window_size.is_enable = true;
+
+        request.transfer_size.value = 0; // RRQ: server reports the file size
+        request.transfer_size.is_enable = true;
+        request.multicast.is_enable = config_.multicast and (request.operation == opcode::RRQ);
+        int64_t file_size = 0;
+        if (request.operation == opcode::WRQ)
+        {
+            file_size = fileSize(job.local.c_str());
+            if (file_size < 0)
+            {
+                result.error = -error_code::FILE_NOT_FOUND;
+                return result;
+            }
+            request.transfer_size.value = file_size;
+        }
+
+        // Sized for the offered options before the server starts sending (negotiated ones can only be smaller)
+        socket.setBufferSize(request.window_size.value * (request.block_size.value + 4),
+                             config_.max_socket_buffer, config_.force_socket_buffer);
+
+        result.error = negotiate(request, socket, buffers);
+        if (result.error != 0)
+        {
+            return result;
+        }
+
+        // Set the buffer before opening: the stream keeps using it across jobs of this worker
+        buffers.file.resize(FILE_BUFFER_SIZE);
+        std::fstream file;
+        file.rdbuf()->pubsetbuf(buffers.file.data(), buffers.file.size());
+
+        Digest digest(config_.digest);
+        Session session;
+        if (config_.digest != DigestType::NONE)
+        {
+            session.digest = &digest;
+        }
+
+        if (request.operation == opcode::WRQ)
+        {
+            file.open(job.local, std::fstream::in | std::fstream::binary);
+            result.error = processRead(request, socket, file, session);
+            result.bytes = file_size; // the server may have ignored the transfer size option
+        }
+        else if (request.multicast.is_enable)
+        {
+            file.open(job.local, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+            result.error = receiveMulticast(request, socket, file, buffers, result.bytes);
+        }
+        else
+        {
+            file.open(job.local, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+            result.error = processWrite(request, socket, file, session);
+            result.bytes = file.tellp();
+        }
+        file.close();
+        result.digest = digest.hex();
+
+        auto end = std::chrono::steady_clock::now();
+        result.seconds = std::chrono::duration<double>(end - begin).count();
+        return result;
+    }
+
+
+    int Client::negotiate(Request& request, Socket& socket, Buffers& buffers)
+    {
+        std::vector<char>& packet = buffers.packet;
+
+        // The request (or its answer) may be lost: send it again on timeout
+        std::vector<char> const datagram = forgeRequest(request);
+        packet.resize(512);
+        int rec = -1;
+        for (int retry = 0; (rec < 0) and (retry <= MAX_RETRY); ++retry)
+        {
+            if (socket.write(datagram) < 0)
+            {
+                return -error_code::SOCKET_UNUSABLE;
+            }
+            rec = socket.read(packet);
+        }
+        if (rec < 0)
+        {
+            return -error_code::RETRY_EXCEEDED;
+        }
+        socket.switchToLast(); // server answers from the TID of the transfer
+
+        if (getOpcode(packet.data(), rec) == opcode::ERROR)
+        {
+            error_code code;
+            std::string msg;
+            parseError(packet.data(), rec, code, msg);
+            TFTP_LOG(ERROR, "Error recevied from server: <%s>\n", msg.c_str());
+            return -error_code::PEER_ERROR;
+        }
+
+        // check OACK answer (if server can handles our options)
+        if (parseOptionAck(packet.data(), rec, request) == 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                negotiated_block_size_  = request.block_size.value;
+                negotiated_window_size_ = request.window_size.value;
+            }
+
+            // Multicast: the ACK is sent by the master once it listens to the group
+            if ((request.operation == opcode::RRQ) and (not request.multicast.is_enable))
+            {
+                packet = forgeAck(0);
+                if (socket.write(packet) < 0)
+                {
+                    return -error_code::SOCKET_UNUSABLE;
+                }
+            }
+            return 0;
+        }
+
+        int block = parseAck(packet.data(), rec);
+        if (block != 0)
+        {
+            TFTP_LOG(ERROR, "Ack value is unexpected: %d\n", block);
+            return -error_code::ILLEGAL_OPERATION;
+        }
+
+        // Plain ACK: server ignored our options
+        for (auto& option : request.supportedOptions())
+        {
+            option->is_enable = false;
+            option->value = option->default_value;
+        }
+        request.multicast.is_enable = false;
+        return 0;
+    }
+
+
+    int Client::receiveMulticast(Request& request, Socket& socket, std::ostream& file, Buffers& buffers, int64_t& bytes)
+    {
+        Socket group;
+        if (group.joinGroup(request.multicast.address.c_str(), request.multicast.port) < 0)
+        {
+            return -error_code::SOCKET_UNUSABLE;
+        }
+        int64_t block_size  = request.block_size.value;
+        int64_t window_size = request.window_size.value;
+        group.setBufferSize(window_size * (block_size + 4), config_.max_socket_buffer, config_.force_socket_buffer);
+
+        // Blocks are received in any order: the stream may be past the start of the file when joining, and goes
+        // on from the first missing block of each master
+        int64_t last_block = 0; // 0: unknown until the short block
+        if (request.transfer_size.is_enable)
+        {
+            last_block = request.transfer_size.value / block_size + 1;
+        }
+        std::vector<bool> received;
+        int64_t first_missing = 1;
+        int64_t latest = 0;     //< last block received, to resolve the 16-bit block numbers
+        bool is_in_sequence = request.multicast.is_master;  //< latest + 1 is known to be the next block sent
+        int64_t acked = 0;      //< last ACK sent as the master
+
+        bool is_master = request.multicast.is_master;
+        auto ack = [&](int64_t block)
+        {
+            // The last block number means the whole file is received: step back one block before it
+            if ((block != last_block) and (block > 0)
+                and (static_cast<uint16_t>(block) == static_cast<uint16_t>(last_block)))
+            {
+                --block;
+            }
+            acked = block;
+            return socket.write(forgeAck(static_cast<uint16_t>(block)));
+        };
+        if (is_master)
+        {
+            ack(0);
+        }
+
+        // Block numbers wrap around on files of more than 65535 blocks: a block is the one following the last
+        // received, else it is resolved from the stream position sent by the server (in the OACK of the join, then
+        // in an OACK to the group before each jump). 0: unknown, the block is received again later.
+        bool is_wrapping = (request.multicast.position > 0) or (last_block > UINT16_MAX);
+        int64_t position = request.multicast.position;
+        auto resolve = [&](int number) -> int64_t
+        {
+            if (is_in_sequence and (number == static_cast<uint16_t>(latest + 1)))
+            {
+                return latest + 1;
+            }
+            if (not is_wrapping)
+            {
+                return number;
+            }
+            if (position > 0)
+            {
+                // The stream went on a little since the join
+                return std::max<int64_t>(position + static_cast<int16_t>(number - static_cast<uint16_t>(position)), 0);
+            }
+            return 0;
+        };
+
+        // Master: the server may resume the stream below the first missing block (it does not know which 16-bit
+        // wrap the ACK of the promotion is in), then it only takes ACKs less than 32768 blocks ahead of its window
+        int64_t hop = std::max<int64_t>(0x7FFF - window_size, 1);
+        auto progress = [&]()
+        {
+            return std::min(first_missing - 1, latest + hop);
+        };
+
+        std::vector<char>& packet = buffers.packet;
+        packet.resize(block_size + 4);
+        int timeouts = 0;
+        while ((last_block == 0) or (first_missing <= last_block))
+        {
+            int index = Socket::waitReadable({&socket, &group}, config_.timeout);
+            if (index < 0)
+            {
+                // The stream also stalls while the server designates another master
+                if (++timeouts > 2 * MAX_RETRY)
+                {
+                    return -error_code::RETRY_EXCEEDED;
+                }
+                if (is_master)
+                {
+                    ack(progress());
+                }
+                continue;
+            }
+            timeouts = 0;
+
+            if (index == 0)
+            {
+                int rec = socket.read(packet);
+                if (rec < 0)
+                {
+                    continue;
+                }
+                opcode operation = getOpcode(packet.data(), rec);
+                if (operation == opcode::ERROR)
+                {
+                    error_code code;
+                    std::string msg;
+                    parseError(packet.data(), rec, code, msg);
+                    TFTP_LOG(ERROR, "Error recevied from server: <%s>\n", msg.c_str());
+                    return -error_code::PEER_ERROR;
+                }
+                Request options{request};
+                if ((operation == opcode::OACK) and (parseOptionAck(packet.data(), rec, options) == 0)
+                    and options.multicast.is_master)
+                {
+                    // This client is the master now: the stream resumes after the ACKed block
+                    is_master = true;
+                    is_in_sequence = not is_wrapping; // else from the position sent to the group
+                    ack(first_missing - 1);
+                    latest = acked;
+                }
+                continue;
+            }
+
+            int rec = group.read(packet);
+            if (rec < 0)
+            {
+                continue;
+            }
+            if (getOpcode(packet.data(), rec) == opcode::OACK)
+            {
+                // The stream jumps: the next DATA is this block
+                Request stream{request};
+                if ((parseOptionAck(packet.data(), rec, stream) == 0) and (stream.multicast.position > 0))
+                {
+                    latest = stream.multicast.position - 1;
+                    is_in_sequence = true;
+                    position = 0;
+                }
+                continue;
+            }
+            int number = parseData(packet.data(), rec);
+            if (number < 0)
+            {
+                continue;
+            }
+            int64_t block = resolve(number);
+            if (block == 0)
+            {
+                is_in_sequence = false; // the stream jumped: lost position, wait for the next one
+                continue;
+            }
+            latest = block;
+            is_in_sequence = true;
+            position = 0;
+            if (rec - 4 < block_size)
+            {
+                last_block = block;
+            }
+
+            bool is_new = (block > static_cast<int64_t>(received.size())) or (not received[block - 1]);
+            if (is_new)
+            {
+                file.seekp((block - 1) * block_size);
+                file.write(packet.data() + 4, rec - 4);
+                if (block > static_cast<int64_t>(received.size()))
+                {
+                    received.resize(block, false);
+                }
+                received[block - 1] = true;
+                while ((first_missing <= static_cast<int64_t>(received.size())) and received[first_missing - 1])
+                {
+                    ++first_missing;
+                }
+                if (block == last_block)
+                {
+                    bytes = (block - 1) * block_size + rec - 4;
+                }
+            }
+
+            // Master: one ACK per window (lower if a block is missing), and again if the whole window is resent
+            if (is_master and ((block >= acked + window_size) or (block == last_block) or ((not is_new) and (block == acked))))
+            {
+                ack(progress());
+            }
+        }
+        if (not file)
+        {
+            return -error_code::IO;
+        }
+
+        // Done: the server skips this client when designating the next master
+        ack(last_block);
+        return 0;
+    }
+}
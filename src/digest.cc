@@ -0,0 +1,323 @@
+#include "digest.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__)
+    #include <cpuid.h>
+    #include <immintrin.h>
+#endif
+
+namespace tftp
+{
+    namespace
+    {
+        constexpr std::array<uint32_t, 8> SHA256_INIT =
+        {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+
+        alignas(16) constexpr uint32_t SHA256_K[64] =
+        {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        // Castagnoli polynomial (reflected)
+        struct Crc32cTable
+        {
+            constexpr Crc32cTable()
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t crc = i;
+                    for (int bit = 0; bit < 8; ++bit)
+                    {
+                        crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+                    }
+                    values[i] = crc;
+                }
+            }
+            uint32_t values[256]{};
+        };
+        constexpr Crc32cTable CRC32C_TABLE;
+
+        uint32_t crc32cSoftware(uint32_t crc, uint8_t const* data, std::size_t size)
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                crc = CRC32C_TABLE.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return crc;
+        }
+
+        uint32_t rotr(uint32_t x, int n)
+        {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        void sha256Software(uint32_t* state, uint8_t const* data, std::size_t blocks)
+        {
+            for (; blocks > 0; --blocks, data += 64)
+            {
+                uint32_t w[64];
+                for (int i = 0; i < 16; ++i)
+                {
+                    w[i] = (uint32_t(data[4 * i]) << 24) | (uint32_t(data[4 * i + 1]) << 16)
+                         | (uint32_t(data[4 * i + 2]) << 8) | uint32_t(data[4 * i + 3]);
+                }
+                for (int i = 16; i < 64; ++i)
+                {
+                    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+
+                uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+                uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+                for (int i = 0; i < 64; ++i)
+                {
+                    uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+                    uint32_t ch = (e & f) ^ (~e & g);
+                    uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+                    uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+                    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+                    uint32_t t2 = s0 + maj;
+                    h = g; g = f; f = e; e = d + t1;
+                    d = c; c = b; b = a; a = t1 + t2;
+                }
+                state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+                state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+            }
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("sse4.2")))
+        uint32_t crc32cHardware(uint32_t crc, uint8_t const* data, std::size_t size)
+        {
+            uint64_t crc64 = crc;
+            for (; size >= 8; size -= 8, data += 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, data, sizeof(word));
+                crc64 = _mm_crc32_u64(crc64, word);
+            }
+            crc = static_cast<uint32_t>(crc64);
+            for (; size > 0; --size, ++data)
+            {
+                crc = _mm_crc32_u8(crc, *data);
+            }
+            return crc;
+        }
+
+        // Four rounds per step, the message schedule is computed four words at a time by sha256msg1/msg2
+        __attribute__((target("sha,sse4.1")))
+        void sha256Hardware(uint32_t* state, uint8_t const* data, std::size_t blocks)
+        {
+            __m128i const BYTE_SWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+            // state is ABCDEFGH, the instructions work on ABEF and CDGH
+            __m128i tmp    = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(&state[0])), 0xB1);
+            __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(&state[4])), 0x1B);
+            __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+            state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+            for (; blocks > 0; --blocks, data += 64)
+            {
+                __m128i const abef = state0;
+                __m128i const cdgh = state1;
+
+                __m128i message[4];
+                for (int i = 0; i < 4; ++i)
+                {
+                    __m128i words = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + 16 * i));
+                    message[i] = _mm_shuffle_epi8(words, BYTE_SWAP);
+                }
+
+                for (int step = 0; step < 16; ++step)
+                {
+                    if (step >= 4)
+                    {
+                        __m128i& w = message[step % 4];
+                        __m128i const& w1 = message[(step + 1) % 4];
+                        __m128i const& w2 = message[(step + 2) % 4];
+                        __m128i const& w3 = message[(step + 3) % 4];
+                        w = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w, w1), _mm_alignr_epi8(w3, w2, 4)), w3);
+                    }
+
+                    __m128i k = _mm_load_si128(reinterpret_cast<__m128i const*>(&SHA256_K[4 * step]));
+                    __m128i msg = _mm_add_epi32(message[step % 4], k);
+                    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+                    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+                }
+
+                state0 = _mm_add_epi32(state0, abef);
+                state1 = _mm_add_epi32(state1, cdgh);
+            }
+
+            tmp    = _mm_shuffle_epi32(state0, 0x1B);
+            state1 = _mm_shuffle_epi32(state1, 0xB1);
+            state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+            state1 = _mm_alignr_epi8(state1, tmp, 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+        }
+#endif
+    }
+
+
+    char const* toString(DigestType type)
+    {
+        switch (type)
+        {
+            case DigestType::CRC32C: { return "crc32c";  }
+            case DigestType::SHA256: { return "sha256";  }
+            default:                 { return "none";    }
+        }
+    }
+
+
+    bool Digest::hasHardwareSupport(DigestType type)
+    {
+#if defined(__x86_64__)
+        switch (type)
+        {
+            case DigestType::CRC32C:
+            {
+                return __builtin_cpu_supports("sse4.2");
+            }
+            case DigestType::SHA256:
+            {
+                unsigned int eax, ebx, ecx, edx;
+                if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+                {
+                    return false;
+                }
+                return ((ebx & bit_SHA) != 0) and __builtin_cpu_supports("sse4.1");
+            }
+            default:
+            {
+                return false;
+            }
+        }
+#else
+        (void) type;
+        return false;
+#endif
+    }
+
+
+    Digest::Digest(DigestType type, bool allow_hardware)
+        : type_{type}
+        , is_accelerated_{allow_hardware and hasHardwareSupport(type)}
+        , state_{SHA256_INIT}
+    {
+    }
+
+
+    void Digest::sha256Blocks(uint8_t const* data, std::size_t blocks)
+    {
+#if defined(__x86_64__)
+        if (is_accelerated_)
+        {
+            sha256Hardware(state_.data(), data, blocks);
+            return;
+        }
+#endif
+        sha256Software(state_.data(), data, blocks);
+    }
+
+
+    void Digest::update(void const* data, std::size_t size)
+    {
+        uint8_t const* bytes = static_cast<uint8_t const*>(data);
+        switch (type_)
+        {
+            case DigestType::CRC32C:
+            {
+#if defined(__x86_64__)
+                if (is_accelerated_)
+                {
+                    crc_ = crc32cHardware(crc_, bytes, size);
+                    return;
+                }
+#endif
+                crc_ = crc32cSoftware(crc_, bytes, size);
+                return;
+            }
+            case DigestType::SHA256:
+            {
+                length_ += size;
+                if (pending_size_ > 0)
+                {
+                    std::size_t chunk = std::min(size, pending_.size() - pending_size_);
+                    std::memcpy(pending_.data() + pending_size_, bytes, chunk);
+                    pending_size_ += chunk;
+                    bytes += chunk;
+                    size -= chunk;
+                    if (pending_size_ < pending_.size())
+                    {
+                        return;
+                    }
+                    sha256Blocks(pending_.data(), 1);
+                    pending_size_ = 0;
+                }
+
+                sha256Blocks(bytes, size / 64);
+                std::memcpy(pending_.data(), bytes + size / 64 * 64, size % 64);
+                pending_size_ = size % 64;
+                return;
+            }
+            default:
+            {
+                return;
+            }
+        }
+    }
+
+
+    std::string Digest::hex() const
+    {
+        char text[65];
+        switch (type_)
+        {
+            case DigestType::CRC32C:
+            {
+                snprintf(text, sizeof(text), "%08x", ~crc_);
+                return text;
+            }
+            case DigestType::SHA256:
+            {
+                // Pad a copy: the transfer may go on
+                Digest final = *this;
+                uint64_t bits = length_ * 8;
+                uint8_t padding[72] = { 0x80 };
+                std::size_t padding_size = ((pending_size_ < 56) ? 56 : 120) - pending_size_;
+                final.update(padding, padding_size);
+                uint8_t length[8];
+                for (int i = 0; i < 8; ++i)
+                {
+                    length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+                }
+                final.update(length, sizeof(length));
+
+                for (int i = 0; i < 8; ++i)
+                {
+                    snprintf(text + 8 * i, 9, "%08x", final.state_[i]);
+                }
+                return text;
+            }
+            default:
+            {
+                return "";
+            }
+        }
+    }
+}
@@ -0,0 +1,207 @@
+#include "log.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdarg>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tftp
+{
+    namespace log
+    {
+        std::atomic<int> active_level{static_cast<int>(LogLevel::INFO)};
+
+        namespace
+        {
+            // Single producer (the owning thread), single consumer (the drain, under its mutex)
+            struct Ring
+            {
+                static constexpr uint64_t SLOTS = 256;
+
+                struct Slot
+                {
+                    LogLevel level;
+                    uint32_t size;
+                    char text[MAX_MESSAGE_SIZE + 4];
+                };
+
+                alignas(64) std::atomic<uint64_t> head{0};  //< next slot to write
+                alignas(64) std::atomic<uint64_t> tail{0};  //< next slot to drain
+                std::array<Slot, SLOTS> slots;
+            };
+
+            class Drain
+            {
+            public:
+                Drain()
+                {
+                    thread_ = std::thread(&Drain::run, this);
+                }
+
+                ~Drain()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        is_running_ = false;
+                    }
+                    cv_.notify_one();
+                    thread_.join();
+                    flush();
+                }
+
+                std::shared_ptr<Ring> attach()
+                {
+                    auto ring = std::make_shared<Ring>();
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    rings_.push_back(ring);
+                    return ring;
+                }
+
+                void flush()
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    drainRings();
+                }
+
+                void setOutput(FILE* output, FILE* error_output)
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    drainRings();
+                    output_ = output;
+                    error_output_ = error_output;
+                }
+
+                std::atomic<uint64_t> dropped{0};
+
+            private:
+                void run()
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    while (is_running_)
+                    {
+                        drainRings();
+                        cv_.wait_for(lock, std::chrono::milliseconds(10));
+                    }
+                }
+
+                // mutex_ shall be locked
+                void drainRings()
+                {
+                    bool written = false;
+                    for (auto it = rings_.begin(); it != rings_.end(); )
+                    {
+                        Ring& ring = **it;
+
+                        // Once the owning thread exited, its last messages are visible after the fence
+                        bool is_orphan = (it->use_count() == 1);
+                        std::atomic_thread_fence(std::memory_order_acquire);
+
+                        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+                        uint64_t head = ring.head.load(std::memory_order_acquire);
+                        for (; tail != head; ++tail)
+                        {
+                            Ring::Slot const& slot = ring.slots[tail % Ring::SLOTS];
+                            FILE* output = (slot.level >= LogLevel::WARNING) ? error_output_ : output_;
+                            fwrite(slot.text, 1, slot.size, output);
+                            written = true;
+                        }
+                        ring.tail.store(tail, std::memory_order_release);
+
+                        if (is_orphan)
+                        {
+                            it = rings_.erase(it);
+                        }
+                        else
+                        {
+                            ++it;
+                        }
+                    }
+
+                    if (written)
+                    {
+                        fflush(output_);
+                        fflush(error_output_);
+                    }
+                }
+
+                std::mutex mutex_;
+                std::condition_variable cv_;
+                std::vector<std::shared_ptr<Ring>> rings_;
+                FILE* output_{stdout};
+                FILE* error_output_{stderr};
+                bool is_running_{true};
+                std::thread thread_;
+            };
+
+            Drain& drain()
+            {
+                static Drain instance;
+                return instance;
+            }
+
+            Ring& localRing()
+            {
+                thread_local std::shared_ptr<Ring> ring = drain().attach();
+                return *ring;
+            }
+        }
+
+
+        void setLevel(LogLevel level)
+        {
+            active_level.store(static_cast<int>(level), std::memory_order_relaxed);
+        }
+
+
+        void setOutput(FILE* output, FILE* error_output)
+        {
+            drain().setOutput(output, error_output);
+        }
+
+
+        void flush()
+        {
+            drain().flush();
+        }
+
+
+        uint64_t dropped()
+        {
+            return drain().dropped.load(std::memory_order_relaxed);
+        }
+
+
+        void write(LogLevel level, char const* format, ...)
+        {
+            Ring& ring = localRing();
+            uint64_t head = ring.head.load(std::memory_order_relaxed);
+            if (head - ring.tail.load(std::memory_order_acquire) >= Ring::SLOTS)
+            {
+                drain().dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            Ring::Slot& slot = ring.slots[head % Ring::SLOTS];
+            slot.level = level;
+            va_list args;
+            va_start(args, format);
+            int size = vsnprintf(slot.text, MAX_MESSAGE_SIZE + 1, format, args);
+            va_end(args);
+            if (size < 0)
+            {
+                return;
+            }
+            slot.size = std::min<uint32_t>(size, MAX_MESSAGE_SIZE);
+            if (static_cast<std::size_t>(size) > MAX_MESSAGE_SIZE)
+            {
+                slot.text[MAX_MESSAGE_SIZE - 1] = '\n'; // truncated: keep the line ending
+            }
+
+            ring.head.store(head + 1, std::memory_order_release);
+        }
+    }
+}
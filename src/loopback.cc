@@ -0,0 +1,250 @@
+#include "loopback.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+
+namespace tftp
+{
+    namespace
+    {
+        constexpr std::chrono::nanoseconds NEVER = std::chrono::nanoseconds::max();
+        constexpr int IP_UDP_HEADERS = 48;  // IPv6 + UDP
+    }
+
+
+    Link::Link(LinkConfig const& a_to_b, LinkConfig const& b_to_a)
+    {
+        directions_[0].config = a_to_b;
+        directions_[0].rng.seed(a_to_b.seed);
+        directions_[1].config = b_to_a;
+        directions_[1].rng.seed(b_to_a.seed);
+
+        for (int side = 0; side < 2; ++side)
+        {
+            endpoints_[side].link_ = this;
+            endpoints_[side].side_ = side;
+        }
+    }
+
+
+    void Link::Endpoint::setTimeout(std::chrono::milliseconds timeout)
+    {
+        std::lock_guard<std::mutex> lock(link_->mutex_);
+        timeout_ = timeout;
+    }
+
+
+    int Link::Endpoint::read(void* data, size_t size)
+    {
+        TFTP_TRACE(RECEIVE);
+        return link_->read(*this, data, size);
+    }
+
+
+    int Link::Endpoint::write(void const* data, size_t size)
+    {
+        TFTP_TRACE(SEND);
+        return link_->write(*this, data, size);
+    }
+
+
+    void Link::Endpoint::close()
+    {
+        link_->close(*this);
+    }
+
+
+    std::chrono::nanoseconds Link::now()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return now_;
+    }
+
+
+    LinkStats Link::stats(Endpoint const& sender)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return directions_[sender.side_].stats;
+    }
+
+
+    bool Link::draw(Direction& direction, double probability)
+    {
+        if (probability <= 0)
+        {
+            return false;
+        }
+        return std::uniform_real_distribution<double>(0.0, 1.0)(direction.rng) < probability;
+    }
+
+
+    int Link::write(Endpoint& endpoint, void const* data, size_t size)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Direction& direction = directions_[endpoint.side_];
+        LinkConfig const& config = direction.config;
+        direction.stats.sent++;
+
+        // Tail drop: a datagram that does not fit in the queue never takes wire time
+        if ((config.queue_limit > 0) and (direction.in_flight_bytes + static_cast<int64_t>(size) > config.queue_limit))
+        {
+            direction.stats.dropped++;
+            return static_cast<int>(size);
+        }
+
+        // Serialization on the wire
+        auto departure = std::max(now_, direction.busy_until);
+        if (config.bandwidth > 0)
+        {
+            direction.busy_until = departure + std::chrono::nanoseconds(size * 1000000000 / config.bandwidth);
+            departure = direction.busy_until;
+        }
+
+        // A fragmented datagram is lost as soon as one of its fragments is lost
+        int fragments = 1;
+        if (config.mtu > 0)
+        {
+            fragments = static_cast<int>((size + IP_UDP_HEADERS + config.mtu - 1) / config.mtu);
+        }
+        for (int i = 0; i < fragments; ++i)
+        {
+            if (draw(direction, config.loss))
+            {
+                direction.stats.lost++;
+                return static_cast<int>(size);
+            }
+        }
+
+        auto arrival = departure + config.latency;
+        if (draw(direction, config.reorder))
+        {
+            direction.stats.reordered++;
+            arrival += config.reorder_delay;
+        }
+
+        char const* begin = static_cast<char const*>(data);
+        int copies = 1;
+        if (draw(direction, config.duplicate))
+        {
+            direction.stats.duplicated++;
+            copies = 2;
+        }
+        for (int i = 0; i < copies; ++i)
+        {
+            direction.in_flight.emplace(arrival, std::vector<char>(begin, begin + size));
+            direction.in_flight_bytes += size;
+        }
+
+        lock.unlock();
+        cv_.notify_all();
+        return static_cast<int>(size);
+    }
+
+
+    int Link::read(Endpoint& endpoint, void* data, size_t size)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Direction& direction = directions_[1 - endpoint.side_];
+
+        endpoint.deadline_ = NEVER;
+        if (endpoint.timeout_.count() > 0)
+        {
+            endpoint.deadline_ = now_ + endpoint.timeout_;
+        }
+
+        while (true)
+        {
+            auto next = direction.in_flight.begin();
+            if ((next != direction.in_flight.end()) and (next->first <= now_))
+            {
+                // Datagram semantic: the remaining part of a too big datagram is discarded
+                size_t len = std::min(size, next->second.size());
+                std::memcpy(data, next->second.data(), len);
+                direction.in_flight_bytes -= next->second.size();
+                direction.in_flight.erase(next);
+                direction.stats.delivered++;
+                endpoint.state_ = Endpoint::RUNNING;
+                return static_cast<int>(len);
+            }
+
+            if (now_ >= endpoint.deadline_)
+            {
+                endpoint.state_ = Endpoint::RUNNING;
+                errno = EAGAIN;
+                return -1;
+            }
+
+            endpoint.state_ = Endpoint::WAITING;
+            if (advance())
+            {
+                continue;
+            }
+
+            bool is_stalled = true;
+            for (auto const& other : endpoints_)
+            {
+                if ((&other != &endpoint) and (other.state_ == Endpoint::RUNNING))
+                {
+                    is_stalled = false;
+                }
+            }
+            if (is_stalled and (endpoint.deadline_ == NEVER) and direction.in_flight.empty())
+            {
+                // Nothing will ever be received: do not hang
+                endpoint.state_ = Endpoint::RUNNING;
+                errno = EDEADLK;
+                return -1;
+            }
+
+            cv_.wait(lock);
+        }
+    }
+
+
+    void Link::close(Endpoint& endpoint)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            endpoint.state_ = Endpoint::CLOSED;
+            advance();
+        }
+        cv_.notify_all();
+    }
+
+
+    bool Link::advance()
+    {
+        // Time is frozen while an end is running: it may still send something
+        std::chrono::nanoseconds next = NEVER;
+        for (auto const& endpoint : endpoints_)
+        {
+            if (endpoint.state_ == Endpoint::RUNNING)
+            {
+                return false;
+            }
+            if (endpoint.state_ == Endpoint::CLOSED)
+            {
+                continue;
+            }
+
+            next = std::min(next, endpoint.deadline_);
+            Direction const& inbound = directions_[1 - endpoint.side_];
+            if (not inbound.in_flight.empty())
+            {
+                next = std::min(next, inbound.in_flight.begin()->first);
+            }
+        }
+
+        if ((next == NEVER) or (next <= now_))
+        {
+            // Nothing to wait for, or an end has something to do right now: let it run
+            cv_.notify_all();
+            return false;
+        }
+
+        now_ = next;
+        cv_.notify_all();
+        return true;
+    }
+}
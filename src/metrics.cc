@@ -0,0 +1,118 @@
+#include "metrics.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace tftp
+{
+    namespace
+    {
+        struct Description
+        {
+            char const* name;
+            char const* help;
+        };
+
+        constexpr Description descriptions[COUNTER_COUNT] =
+        {
+            { "packets_sent_total",     "Packets sent" },
+            { "bytes_sent_total",       "Bytes sent (TFTP header included)" },
+            { "packets_received_total", "Packets received" },
+            { "bytes_received_total",   "Bytes received (TFTP header included)" },
+            { "retransmits_total",      "Data packets sent again" },
+            { "timeouts_total",         "Timeouts while waiting for the peer" },
+            { "dropped_total",          "Out-of-order data blocks dropped" },
+            { "ignored_total",          "Stale (duplicated or delayed) packets ignored" },
+            { "acks_total",             "ACKs acknowledging new blocks" },
+            { "acked_blocks_total",     "Blocks acknowledged, divide by acks_total for the achieved window" },
+            { "rtt_seconds_count",      "" },
+            { "rtt_seconds_sum",        "" },
+            { "sessions_total",         "Transfers served" },
+            { "failed_sessions_total",  "Transfers aborted on error" },
+        };
+    }
+
+
+    SessionMetrics::SessionMetrics(MetricsShard* shard)
+        : shard_{shard}
+    {
+    }
+
+
+    void SessionMetrics::addRtt(std::chrono::microseconds sample)
+    {
+        if (srtt_.count() == 0)
+        {
+            srtt_ = sample;
+        }
+        else
+        {
+            srtt_ = (7 * srtt_ + sample) / 8;
+        }
+        add(RTT_SAMPLES);
+        add(RTT_SUM_US, sample.count());
+    }
+
+
+    double SessionMetrics::window() const
+    {
+        if (counters_[ACKS] == 0)
+        {
+            return 0;
+        }
+        return static_cast<double>(counters_[ACKED_BLOCKS]) / counters_[ACKS];
+    }
+
+
+    MetricsRegistry::MetricsRegistry(int shards)
+        : shards_(shards)
+    {
+    }
+
+
+    Counters MetricsRegistry::totals() const
+    {
+        Counters totals{};
+        for (auto const& shard : shards_)
+        {
+            for (int i = 0; i < COUNTER_COUNT; ++i)
+            {
+                totals[i] += shard.counters[i].load(std::memory_order_relaxed);
+            }
+        }
+        return totals;
+    }
+
+
+    char const* toString(Counter counter)
+    {
+        return descriptions[counter].name;
+    }
+
+
+    std::string toPrometheus(Counters const& counters, char const* prefix)
+    {
+        std::string text;
+        char line[256];
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            if ((i == RTT_SAMPLES) or (i == RTT_SUM_US))
+            {
+                continue;
+            }
+            snprintf(line, sizeof(line), "# HELP %s_%s %s\n# TYPE %s_%s counter\n%s_%s %" PRIu64 "\n",
+                     prefix, descriptions[i].name, descriptions[i].help,
+                     prefix, descriptions[i].name,
+                     prefix, descriptions[i].name, counters[i]);
+            text += line;
+        }
+
+        snprintf(line, sizeof(line), "# HELP %s_rtt_seconds Round-trip time from the end of a window to its ACK\n"
+                                     "# TYPE %s_rtt_seconds summary\n"
+                                     "%s_rtt_seconds_sum %.6f\n%s_rtt_seconds_count %" PRIu64 "\n",
+                 prefix, prefix,
+                 prefix, counters[RTT_SUM_US] / 1000000.0, prefix, counters[RTT_SAMPLES]);
+        text += line;
+        return text;
+    }
+}
@@ -0,0 +1,132 @@
+#include "policy.h"
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace tftp
+{
+    namespace
+    {
+        bool parseAddress(std::string const& address, std::array<uint8_t, 16>& bytes)
+        {
+            return inet_pton(AF_INET6, address.c_str(), bytes.data()) == 1;
+        }
+
+        bool isInPrefix(std::array<uint8_t, 16> const& address, std::array<uint8_t, 16> const& prefix, int length)
+        {
+            for (int i = 0; i < length; i += 8)
+            {
+                uint8_t mask = static_cast<uint8_t>(0xFF << std::max(0, 8 - (length - i)));
+                if ((address[i / 8] & mask) != (prefix[i / 8] & mask))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+
+    OptionPolicy::OptionPolicy(std::vector<PolicyRule> const& rules, int64_t memory_budget, int64_t max_socket_buffer)
+        : memory_budget_{memory_budget}
+        , max_socket_buffer_{max_socket_buffer}
+    {
+        for (auto const& limits : rules)
+        {
+            Rule rule{{}, 128, limits};
+            std::string address = limits.subnet;
+            size_t slash = address.find('/');
+            if (slash != std::string::npos)
+            {
+                // The whole suffix shall be a decimal length: "/24x", "/ 24" or "/" are rejected
+                char const* digits = address.c_str() + slash + 1;
+                char* end = nullptr;
+                long length = strtol(digits, &end, 10);
+                bool is_number = isdigit(static_cast<unsigned char>(*digits)) and (*end == '\0');
+                rule.length = is_number ? static_cast<int>(std::min(length, 129L)) : -1;
+                address.resize(slash);
+            }
+            if ((not parseAddress(address, rule.prefix)) or (rule.length < 0) or (rule.length > 128))
+            {
+                TFTP_LOG(ERROR, "policy: invalid subnet %s\n", limits.subnet.c_str());
+                is_valid_ = false;
+                continue;
+            }
+            rules_.push_back(rule);
+        }
+    }
+
+
+    PolicyRule const* OptionPolicy::match(std::string const& client, std::string const& filename) const
+    {
+        std::array<uint8_t, 16> address;
+        if (not parseAddress(client, address))
+        {
+            return nullptr;
+        }
+
+        for (auto const& rule : rules_)
+        {
+            std::string const& suffix = rule.limits.file_suffix;
+            bool is_file_class = (filename.size() >= suffix.size())
+                             and (filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0);
+            if (is_file_class and isInPrefix(address, rule.prefix, rule.length))
+            {
+                return &rule.limits;
+            }
+        }
+        return nullptr;
+    }
+
+
+    OptionPolicy::Grant::Grant(OptionPolicy& policy, std::string const& client, Request& request)
+        : policy_{policy}
+    {
+        PolicyRule const* rule = policy_.match(client, request.filename);
+        if (rule != nullptr)
+        {
+            if (request.block_size.is_enable)
+            {
+                request.block_size.value = std::max(BLKSIZE.min, std::min(request.block_size.value, rule->max_block_size));
+            }
+            if (request.window_size.is_enable)
+            {
+                request.window_size.value = std::max(WINDOWSIZE.min, std::min(request.window_size.value, rule->max_window_size));
+            }
+            if (rule->timeout > 0)
+            {
+                request.timeout.value = rule->timeout;
+            }
+        }
+
+        if (policy_.memory_budget_ <= 0)
+        {
+            return;
+        }
+
+        // Socket::setBufferSize asks twice the window (kernel accounting of each datagram) for the receive and
+        // the send buffers
+        constexpr int64_t KERNEL_FACTOR = 2 * 2;
+        int64_t packet_size = request.block_size.value + 4;
+        std::lock_guard<std::mutex> lock(policy_.mutex_);
+        int64_t share = std::max<int64_t>(policy_.memory_budget_ - policy_.reserved_, 0) / 2;
+        int64_t window_size = std::max<int64_t>(share / (packet_size * KERNEL_FACTOR), 1);
+        if (request.window_size.value > window_size)
+        {
+            request.window_size.value = window_size;
+            ++policy_.shrunk_;
+        }
+        bytes_ = std::min(request.window_size.value * packet_size, policy_.max_socket_buffer_) * KERNEL_FACTOR;
+        policy_.reserved_ += bytes_;
+    }
+
+
+    OptionPolicy::Grant::~Grant()
+    {
+        std::lock_guard<std::mutex> lock(policy_.mutex_);
+        policy_.reserved_ -= bytes_;
+    }
+}
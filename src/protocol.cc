@@ -1,4 +1,7 @@
 #include "protocol.h"
+#include "log.h"
+#include "session.h"
+#include "trace.h"
 
 #include <functional>
 #include <cstring>
@@ -46,7 +49,39 @@ namespace tftp
             return std::tolower(a) == std::tolower(b);
         };
 
-        for (auto option : req.supported_options)
+        if (std::equal(position, position + entryLen(data, size, position), Multicast::NAME, cmp))
+        {
+            position += entryLen(data, size, position);
+
+            // "address,port,mc[,position]", each field may be empty
+            size_t len = entryLen(data, size, position);
+            std::string value(position, strnlen(position, len));
+            position += len;
+
+            req.multicast.is_enable = true;
+            size_t first = value.find(',');
+            size_t second = (first == std::string::npos) ? std::string::npos : value.find(',', first + 1);
+            if (second != std::string::npos)
+            {
+                if (first > 0)
+                {
+                    req.multicast.address = value.substr(0, first);
+                }
+                if (second > first + 1)
+                {
+                    req.multicast.port = atoi(value.c_str() + first + 1);
+                }
+                size_t third = value.find(',', second + 1);
+                req.multicast.is_master = (value.compare(second + 1, third - (second + 1), "1") == 0);
+                if (third != std::string::npos)
+                {
+                    req.multicast.position = atoll(value.c_str() + third + 1);
+                }
+            }
+            return true;
+        }
+
+        for (auto option : req.supportedOptions())
         {
             if (std::equal(position, position + entryLen(data, size, position), option->name, cmp))
             {
@@ -143,7 +178,7 @@ namespace tftp
         insert(buffer, toString(request.mode));
 
         // write options
-        for (auto const& option : request.supported_options)
+        for (auto const& option : request.supportedOptions())
         {
             if (not option->is_enable)
             {
@@ -152,6 +187,11 @@ namespace tftp
             insert(buffer, option->name);
             insert(buffer, std::to_string(option->value));
         }
+        if (request.multicast.is_enable)
+        {
+            insert(buffer, Multicast::NAME);
+            insert(buffer, "");
+        }
 
         return buffer;
     }
@@ -174,11 +214,14 @@ namespace tftp
         pos += 2;
 
         // Set all option to false/default to accept only the one the server sent to us
-        for (auto& option : request.supported_options)
+        for (auto& option : request.supportedOptions())
         {
             option->is_enable = false;
             option->value = option->default_value;
         }
+        request.multicast.is_enable = false;
+        request.multicast.is_master = false;
+        request.multicast.position = 0;
 
         // Parse options
         while ((pos - data) < static_cast<ssize_t>(size))
@@ -205,7 +248,7 @@ namespace tftp
         uint16_t const opcode = hton(opcode::OACK);
         insert(buffer, opcode);
 
-        for (auto const& option : request.supported_options)
+        for (auto const& option : request.supportedOptions())
         {
             if (not option->is_enable)
             {
@@ -215,6 +258,17 @@ namespace tftp
             insert(buffer, option->name);
             insert(buffer, std::to_string(option->value).c_str());
         }
+        if (request.multicast.is_enable)
+        {
+            std::string value = request.multicast.address + "," + std::to_string(request.multicast.port) + ","
+                              + (request.multicast.is_master ? "1" : "0");
+            if (request.multicast.position > 0)
+            {
+                value += "," + std::to_string(request.multicast.position);
+            }
+            insert(buffer, Multicast::NAME);
+            insert(buffer, value);
+        }
 
         if (buffer.size() == 2)
         {
@@ -232,6 +286,16 @@ namespace tftp
     }
 
 
+    int64_t maxBlockSize(int datagram_payload)
+    {
+        if (datagram_payload < 0)
+        {
+            return BLKSIZE.default_value;
+        }
+        return std::clamp<int64_t>(datagram_payload - 4, BLKSIZE.min, BLKSIZE.max); // 4 -> opcode (2) + block (2)
+    }
+
+
     int parseData(char const* data, size_t size)
     {
         char const* pos = data;
@@ -259,19 +323,25 @@ namespace tftp
     {
         std::vector<char> buffer;
         int max_size = request.block_size.value + 4;
-        buffer.reserve(max_size);
+        {
+            TFTP_TRACE(FORGE);
+            buffer.reserve(max_size);
 
-        // write opcode
-        uint16_t const opcode = hton(opcode::DATA);
-        insert(buffer, opcode);
+            // write opcode
+            uint16_t const opcode = hton(opcode::DATA);
+            insert(buffer, opcode);
 
-        // write block id
-        uint16_t const block_id = hton(static_cast<uint16_t>(block));
-        insert(buffer, block_id);
+            // write block id
+            uint16_t const block_id = hton(static_cast<uint16_t>(block));
+            insert(buffer, block_id);
+            buffer.resize(max_size);
+        }
 
         // write data
-        buffer.resize(max_size);
-        input.read(buffer.data() + 4, request.block_size.value);
+        {
+            TFTP_TRACE(FILE_READ);
+            input.read(buffer.data() + 4, request.block_size.value);
+        }
         if (not input)
         {
             // cut unread part
@@ -372,23 +442,64 @@ namespace tftp
     }
 
 
-    void processRead(Request const& request, AbstractSocket& socket, std::istream& file)
+    int processRead(Request const& request, AbstractSocket& socket, std::istream& file)
     {
-        bool isTransferFinish = false;
-        auto writeData = [&](int block)
+        Session session;
+        return processRead(request, socket, file, session);
+    }
+
+
+    int processWrite(Request const& request, AbstractSocket& socket, std::ostream& file)
+    {
+        Session session;
+        return processWrite(request, socket, file, session);
+    }
+
+
+    int processRead(Request const& request, AbstractSocket& socket, std::istream& file, Session& session)
+    {
+        TFTP_TRACE_SESSION(session.tracer);
+        int last_block = -1; // block id of the last data packet when it is part of the sent window
+        int64_t next_new_block = 1; // absolute id of the first block never sent
+        auto writeData = [&](int block, int64_t absolute_block)
         {
+            last_block = -1;
             for (uint32_t i = 0; i < request.window_size.value; ++i)
             {
                 auto dataPacket = forgeData(request, block, file);
+                if (session.flow != nullptr)
+                {
+                    TFTP_TRACE(PACING);
+                    session.flow->acquire(dataPacket.size());
+                }
+                if (session.stream_position != nullptr)
+                {
+                    *session.stream_position = absolute_block + i;
+                }
                 int written = socket.write(dataPacket);
                 if (written < 0)
                 {
                     return -1;
                 }
+                session.count(PACKETS_SENT);
+                session.count(BYTES_SENT, written);
+                if (absolute_block + i < next_new_block)
+                {
+                    session.count(RETRANSMITS);
+                }
+                else
+                {
+                    next_new_block = absolute_block + i + 1;
+                    if (session.digest != nullptr)
+                    {
+                        TFTP_TRACE(DIGEST);
+                        session.digest->update(dataPacket.data() + 4, dataPacket.size() - 4);
+                    }
+                }
 
                 if (tftp::isLastDataPacket(dataPacket.size(), request))
                 {
-                    isTransferFinish = true;
+                    last_block = static_cast<uint16_t>(block);
                     break;
                 }
 
@@ -397,12 +508,21 @@ namespace tftp
             return 0;
         };
 
+        int64_t last_absolute_block = 0;
+        if (session.is_multicast)
+        {
+            file.clear(); // a previous master may have left the stream at the end of file
+            file.seekg(0, std::ios::end);
+            last_absolute_block = static_cast<int64_t>(file.tellg()) / request.block_size.value + 1;
+            next_new_block = session.first_block;
+        }
+
         try
         {
             int retry = 0;
-            int window_block = 1;
-            int absolute_block = 1;
-            while (not isTransferFinish)
+            int window_block = static_cast<uint16_t>(session.first_block);
+            int absolute_block = static_cast<int>(session.first_block);
+            while (true)
             {
                 if (retry > MAX_RETRY)
                 {
@@ -411,72 +531,149 @@ namespace tftp
 
                 // Set file read cursor on absolute block position (so that acked block is always synced with file cursor position)
                 // -1 because the first index is 1, not 0
+                // The stream may be in fail state if the previous window reached the end of file
+                file.clear();
                 file.seekg((absolute_block - 1) * request.block_size.value);
 
-                int ret = writeData(window_block);
+                // RTT is only sampled on windows made of new blocks: the ACK of a retransmitted block is ambiguous
+                bool is_new_window = (absolute_block == next_new_block);
+                int ret = writeData(window_block, absolute_block);
                 if (ret < 0)
                 {
                     ++retry;
                     continue;
                 }
+                std::chrono::steady_clock::time_point window_sent;
+                if (session.metrics != nullptr)
+                {
+                    window_sent = std::chrono::steady_clock::now();
+                }
 
+                // Wait for an ACK making progress on this window. ACKs without progress (duplicated, delayed or
+                // re-sent by the receiver) are ignored: answering them with a retransmission leads to the
+                // Sorcerer's Apprentice Syndrome. Lost packets are only resent on timeout.
                 std::vector<char> packet;
                 packet.resize(512);
-                int rec = socket.read(packet);
+                int rec = 0;
+                int ack_block = 0;
+                uint16_t sent_blocks = 0;
+                {
+                    TFTP_TRACE(WAIT_ACK);
+                    while (true)
+                    {
+                        rec = socket.read(packet);
+                        if (rec < 0)
+                        {
+                            session.count(TIMEOUTS);
+                            break;
+                        }
+                        session.count(PACKETS_RECEIVED);
+                        session.count(BYTES_RECEIVED, rec);
+
+                        if (getOpcode(packet.data(), rec) == opcode::ERROR)
+                        {
+                            error_code code;
+                            std::string msg;
+                            parseError(packet.data(), rec, code, msg);
+                            throw msg;
+                        }
+
+                        ack_block = parseAck(packet.data(), rec);
+                        if (ack_block < 0)
+                        {
+                            throw error_code(-ack_block);
+                        }
+
+                        sent_blocks = ack_block + 1 - window_block;
+                        if ((sent_blocks != 0) and (sent_blocks <= request.window_size.value))
+                        {
+                            break;
+                        }
+                        if (session.is_multicast and (sent_blocks != 0) and (sent_blocks < 0x8000))
+                        {
+                            break; // the master client already has the following blocks
+                        }
+                        if (session.is_multicast and (ack_block == static_cast<uint16_t>(last_absolute_block)))
+                        {
+                            break; // only sent once the master client has the whole file
+                        }
+                        session.count(IGNORED);
+                    }
+                }
                 if (rec < 0)
                 {
                     ++retry;
-                    isTransferFinish = false;
                     continue;
                 }
 
-                if (getOpcode(packet.data(), rec) == opcode::ERROR)
+                if (session.metrics != nullptr)
                 {
-                    error_code code;
-                    std::string msg;
-                    parseError(packet.data(), rec, code, msg);
-                    throw msg;
+                    session.metrics->add(ACKS);
+                    session.metrics->add(ACKED_BLOCKS, sent_blocks);
+                    if (is_new_window)
+                    {
+                        auto rtt = std::chrono::steady_clock::now() - window_sent;
+                        session.metrics->addRtt(std::chrono::duration_cast<std::chrono::microseconds>(rtt));
+                    }
                 }
 
-                int ack_block = parseAck(packet.data(), rec);
-                if (ack_block < 0)
+                if (ack_block == last_block)
                 {
-                    throw error_code(-ack_block);
+                    break; // last data packet acked: transfer done
+                }
+                if (session.is_multicast and (ack_block == static_cast<uint16_t>(last_absolute_block)))
+                {
+                    break;
                 }
-                uint16_t sent_blocks = ack_block + 1 - window_block;
                 absolute_block += sent_blocks;
+                if (session.is_multicast and (absolute_block > last_absolute_block))
+                {
+                    break; // acked ahead up to the last block
+                }
                 window_block = ack_block + 1; // next block to send
+                retry = 0;  // reset retry after every success
             }
         }
         catch(enum error_code const& e)
         {
             auto reply = tftp::forgeError(e);
             socket.write(reply);
-            printf("error: %s\n", toString(e));
+            TFTP_LOG(ERROR, "error: %s\n", toString(e));
+            return -e;
         }
         catch(std::string const& e)
         {
-            printf("rec error: %s\n", e.c_str());
+            TFTP_LOG(ERROR, "rec error: %s\n", e.c_str());
+            return -error_code::PEER_ERROR;
         }
+
+        return 0;
     }
 
 
-    void processWrite(Request const& request, AbstractSocket& socket, std::ostream& file)
+    int processWrite(Request const& request, AbstractSocket& socket, std::ostream& file, Session& session)
     {
+        TFTP_TRACE_SESSION(session.tracer);
         std::vector<char> packet;
         packet.resize(request.block_size.value + 4);
 
         bool isTransferFinish = false;
+        int64_t window_bytes = 0;
+        int nacked_block = -1; // last block reported missing, reported once to not flood the sender with ACKs
         auto readData = [&](int last_acked_block)
         {
             uint16_t expected_block = last_acked_block + 1;
             int last_written_block = last_acked_block;
-            int block = 0;
-            for (int32_t i = 0; i < request.window_size.value; ++i)
+            while (true)
             {
                 int rec = socket.read(packet);
                 if (rec < 0)
                 {
+                    session.count(TIMEOUTS);
+                    if (last_written_block != last_acked_block)
+                    {
+                        return last_written_block; // ack what has been received so far
+                    }
                     return -1;
                 }
 
@@ -488,21 +685,52 @@ namespace tftp
                     throw msg;
                 }
 
-                block = tftp::parseData(packet.data(), rec);
+                int block = tftp::parseData(packet.data(), rec);
                 if (block < 0)
                 {
                     throw error_code(-block);
                 }
+                session.count(PACKETS_RECEIVED);
+                session.count(BYTES_RECEIVED, rec);
 
                 // Check that the block id is the one expected, if not skip it
                 if (expected_block != block)
                 {
-                    printf("DROP %d - expected: %d\n", block, expected_block);
+                    if (block == static_cast<uint16_t>(last_acked_block))
+                    {
+                        session.count(IGNORED);
+                        return last_written_block; // the sender resends the previous window: its ACK was lost
+                    }
+
+                    uint16_t ahead = block - expected_block;
+                    if (ahead >= request.window_size.value)
+                    {
+                        session.count(IGNORED);
+                        continue; // already received (duplicate or retransmission): not part of this window
+                    }
+
+                    session.count(DROPPED);
+                    TFTP_LOG(DEBUG, "DROP %d - expected: %d\n", block, expected_block);
+                    if (nacked_block != expected_block)
+                    {
+                        // A block is missing: ack what has been received so that the sender restarts from there
+                        nacked_block = expected_block;
+                        return last_written_block;
+                    }
                     continue;
                 }
 
                 // TODO handle netascii
-                file.write(packet.data() + 4, rec - 4);
+                {
+                    TFTP_TRACE(FILE_WRITE);
+                    file.write(packet.data() + 4, rec - 4);
+                }
+                if (session.digest != nullptr)
+                {
+                    TFTP_TRACE(DIGEST);
+                    session.digest->update(packet.data() + 4, rec - 4);
+                }
+                window_bytes += rec;
                 expected_block = block + 1;
                 last_written_block = block;
 
@@ -511,6 +739,12 @@ namespace tftp
                     isTransferFinish = true;
                     break;
                 }
+
+                uint16_t received = block - last_acked_block;
+                if (received >= request.window_size.value)
+                {
+                    break; // whole window received
+                }
             }
 
             return last_written_block;
@@ -534,11 +768,42 @@ namespace tftp
                     continue;
                 }
 
-                std::vector<char> reply = tftp::forgeAck(block);
+                if (isTransferFinish)
+                {
+                    // The final ACK tells the client that its file is stored: write what the sink buffers (and
+                    // apply its durability policy) first
+                    TFTP_TRACE(FILE_WRITE);
+                    file.flush();
+                }
+                if (not file)
+                {
+                    throw error_code::IO; // never acknowledge blocks that could not be written
+                }
+
+                std::vector<char> reply;
+                {
+                    TFTP_TRACE(FORGE);
+                    reply = tftp::forgeAck(block);
+                }
+                if (session.flow != nullptr)
+                {
+                    // Uploads are paced by delaying the ACK until the received window is paid
+                    TFTP_TRACE(PACING);
+                    session.flow->acquire(window_bytes);
+                    window_bytes = 0;
+                }
                 if (socket.write(reply) < 0)
                 {
                     throw error_code::IO;
                 }
+                session.count(PACKETS_SENT);
+                session.count(BYTES_SENT, reply.size());
+                uint16_t acked_blocks = block - last_acked_block;
+                if (acked_blocks != 0)
+                {
+                    session.count(ACKS);
+                    session.count(ACKED_BLOCKS, acked_blocks);
+                }
 
                 last_acked_block = block;
                 retry = 0;  // reset retry after every success
@@ -548,11 +813,15 @@ namespace tftp
         {
             auto reply = tftp::forgeError(e);
             socket.write(reply);
-            printf("error: %s\n", toString(e));
+            TFTP_LOG(ERROR, "error: %s\n", toString(e));
+            return -e;
         }
         catch(std::string const& e)
         {
-            printf("rec error: %s\n", e.c_str());
+            TFTP_LOG(ERROR, "rec error: %s\n", e.c_str());
+            return -error_code::PEER_ERROR;
         }
+
+        return 0;
     }
 }
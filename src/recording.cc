@@ -0,0 +1,161 @@
+#include "recording.h"
+
+#include <cstring>
+
+namespace tftp
+{
+    namespace
+    {
+        constexpr char MAGIC[8] = {'T', 'F', 'T', 'P', 'R', 'E', 'C', 1};
+
+        void writeVarint(std::ostream& output, uint64_t value)
+        {
+            char buffer[10];
+            int size = 0;
+            do
+            {
+                buffer[size] = static_cast<char>(value & 0x7F);
+                value >>= 7;
+                if (value != 0)
+                {
+                    buffer[size] |= 0x80;
+                }
+                ++size;
+            } while (value != 0);
+            output.write(buffer, size);
+        }
+
+        bool readVarint(std::istream& input, uint64_t& value)
+        {
+            value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                int byte = input.get();
+                if (byte == std::istream::traits_type::eof())
+                {
+                    return false;
+                }
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // DATA packets are stored without their payload
+        size_t storedSize(void const* data, size_t size)
+        {
+            if (getOpcode(static_cast<char const*>(data), size) == opcode::DATA)
+            {
+                return std::min<size_t>(size, 4);
+            }
+            return size;
+        }
+    }
+
+
+    RecordingSocket::RecordingSocket(AbstractSocket& socket, std::ostream& output,
+                                     std::chrono::steady_clock::time_point begin)
+        : socket_{socket}
+        , output_{output}
+        , begin_{begin}
+    {
+        output_.write(MAGIC, sizeof(MAGIC));
+    }
+
+
+    void RecordingSocket::record(RecordType type, void const* data, size_t size,
+                                 std::chrono::steady_clock::time_point when)
+    {
+        auto now = std::chrono::duration_cast<std::chrono::microseconds>(when - begin_);
+        output_.put(static_cast<char>(type));
+        writeVarint(output_, (now - last_).count());
+        writeVarint(output_, size);
+        output_.write(static_cast<char const*>(data), storedSize(data, size));
+        last_ = now;
+    }
+
+
+    void RecordingSocket::recordRequest(std::vector<char> const& packet)
+    {
+        record(RecordType::REQUEST, packet.data(), packet.size(), begin_);
+    }
+
+
+    void RecordingSocket::setTimeout(std::chrono::milliseconds timeout)
+    {
+        socket_.setTimeout(timeout);
+    }
+
+
+    int RecordingSocket::read(void* data, size_t size)
+    {
+        int rec = socket_.read(data, size);
+        if (rec < 0)
+        {
+            record(RecordType::READ_TIMEOUT, nullptr, 0);
+            return rec;
+        }
+        record(RecordType::RECEIVED, data, rec);
+        return rec;
+    }
+
+
+    int RecordingSocket::write(void const* data, size_t size)
+    {
+        int written = socket_.write(data, size);
+        if (written >= 0)
+        {
+            record(RecordType::SENT, data, size);
+        }
+        return written;
+    }
+
+
+    int readRecording(std::istream& input, std::vector<Record>& records)
+    {
+        char magic[sizeof(MAGIC)];
+        if ((not input.read(magic, sizeof(magic))) or (memcmp(magic, MAGIC, sizeof(MAGIC)) != 0))
+        {
+            return -1;
+        }
+
+        std::chrono::microseconds time{0};
+        while (true)
+        {
+            int type = input.get();
+            if (type == std::istream::traits_type::eof())
+            {
+                return 0;
+            }
+            if (type > static_cast<int>(RecordType::READ_TIMEOUT))
+            {
+                return -1;
+            }
+
+            uint64_t delta;
+            uint64_t size;
+            if ((not readVarint(input, delta)) or (not readVarint(input, size)) or (size > UINT16_MAX))
+            {
+                return -1;
+            }
+            time += std::chrono::microseconds(delta);
+
+            Record record{static_cast<RecordType>(type), time, static_cast<uint32_t>(size), {}};
+            record.data.resize(size);
+            if (not input.read(record.data.data(), std::min<uint64_t>(size, 4)))
+            {
+                return -1;
+            }
+            size_t stored = storedSize(record.data.data(), size);
+            if ((stored > 4) and (not input.read(record.data.data() + 4, stored - 4)))
+            {
+                return -1;
+            }
+            record.data.resize(stored);
+            records.push_back(std::move(record));
+        }
+    }
+}
@@ -0,0 +1,181 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace tftp
+{
+    namespace
+    {
+        // Minimal burst: one maximal DATA packet (blksize 65464 + header)
+        constexpr double MIN_BURST = 65468;
+
+        double burstOf(int64_t rate)
+        {
+            // 10ms of traffic
+            return std::max(MIN_BURST, rate / 100.0);
+        }
+    }
+
+
+    void Scheduler::Bucket::refill(clock::time_point now)
+    {
+        double elapsed = std::chrono::duration<double>(now - last_refill).count();
+        tokens = std::min(burst, tokens + elapsed * rate);
+        last_refill = now;
+    }
+
+
+    Scheduler::clock::time_point Scheduler::Bucket::nextCredit(clock::time_point now) const
+    {
+        // Bucket is in debt: wait until it is refilled
+        auto wait = std::chrono::duration<double>(-tokens / rate);
+        return now + std::chrono::duration_cast<clock::duration>(wait) + std::chrono::microseconds(1);
+    }
+
+
+    Scheduler::Scheduler(int64_t global_rate, int64_t client_rate)
+        : is_limited_{(global_rate > 0) or (client_rate > 0)}
+        , client_rate_{client_rate}
+        , global_{global_rate, burstOf(global_rate), burstOf(global_rate), clock::now()}
+    {
+    }
+
+
+    Scheduler::Flow::Flow(Scheduler& scheduler, std::string const& client)
+        : scheduler_{scheduler}
+        , client_{client}
+    {
+        scheduler_.attach(*this);
+    }
+
+
+    Scheduler::Flow::~Flow()
+    {
+        scheduler_.detach(*this);
+    }
+
+
+    void Scheduler::Flow::acquire(int64_t bytes)
+    {
+        scheduler_.acquire(*this, bytes);
+    }
+
+
+    void Scheduler::attach(Flow& flow)
+    {
+        if (client_rate_ <= 0)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = clients_.find(flow.client_);
+        if (it == clients_.end())
+        {
+            Bucket bucket{client_rate_, burstOf(client_rate_), burstOf(client_rate_), clock::now()};
+            it = clients_.emplace(flow.client_, bucket).first;
+        }
+        it->second.users++;
+    }
+
+
+    void Scheduler::detach(Flow& flow)
+    {
+        if (client_rate_ <= 0)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = clients_.find(flow.client_);
+        if (--it->second.users == 0)
+        {
+            clients_.erase(it);
+        }
+    }
+
+
+    void Scheduler::acquire(Flow& flow, int64_t bytes)
+    {
+        if (not is_limited_)
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        // Start-time fair queuing: an idle flow restarts at the current virtual time (no credit banking)
+        Ticket ticket;
+        ticket.start_tag = std::max(virtual_time_, flow.finish_tag_);
+        ticket.sequence  = sequence_++;
+        ticket.client    = nullptr;
+        if (client_rate_ > 0)
+        {
+            ticket.client = &clients_.find(flow.client_)->second;
+        }
+        flow.finish_tag_ = ticket.start_tag + bytes;
+        waiting_.insert(ticket);
+
+        while (true)
+        {
+            auto now = clock::now();
+            if (global_.rate > 0)
+            {
+                global_.refill(now);
+            }
+
+            // First eligible ticket (whose client is not over its cap) gets the credits
+            clock::time_point wake_up = clock::time_point::max();
+            bool is_first = false;
+            for (auto const& waiting : waiting_)
+            {
+                if (waiting.client != nullptr)
+                {
+                    waiting.client->refill(now);
+                    if (waiting.client->tokens < 0)
+                    {
+                        if (waiting.sequence == ticket.sequence)
+                        {
+                            wake_up = waiting.client->nextCredit(now);
+                            break;
+                        }
+                        continue;
+                    }
+                }
+                is_first = (waiting.sequence == ticket.sequence);
+                break;
+            }
+
+            if (is_first)
+            {
+                if ((global_.rate <= 0) or (global_.tokens >= 0))
+                {
+                    // Tokens may go negative: big packets are allowed, the next ones pay the debt
+                    if (global_.rate > 0)
+                    {
+                        global_.tokens -= bytes;
+                    }
+                    if (ticket.client != nullptr)
+                    {
+                        ticket.client->tokens -= bytes;
+                    }
+                    virtual_time_ = ticket.start_tag;
+                    waiting_.erase(ticket);
+                    lock.unlock();
+                    cv_.notify_all();
+                    return;
+                }
+                wake_up = global_.nextCredit(now);
+            }
+
+            if (wake_up == clock::time_point::max())
+            {
+                cv_.wait(lock);
+            }
+            else
+            {
+                cv_.wait_until(lock, wake_up);
+            }
+        }
+    }
+}
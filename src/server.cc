@@ -0,0 +1,691 @@
+#include "server.h"
+#include "log.h"
+#include "recording.h"
+#include "session.h"
+#include "OS/File.h"
+#include "OS/Thread.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <fstream>
+
+namespace tftp
+{
+    namespace
+    {
+        // Socket of a multicast stream: DATA packets are sent to the group, the other ones (ERROR) and the reads
+        // are the ones of the master client. When block numbers wrap around, a DATA that does not follow the
+        // previous one is preceded by an OACK to the group with its absolute block (stream position).
+        class MulticastSocket final : public AbstractSocket
+        {
+        public:
+            MulticastSocket(Socket& group, AbstractSocket& master, Request const& stream,
+                            std::atomic<int64_t> const* position)
+                : group_{group}
+                , master_{master}
+                , stream_{stream}
+                , position_{position}
+            {
+                stream_.multicast.is_master = false;
+            }
+
+            void setTimeout(std::chrono::milliseconds timeout) override
+            {
+                master_.setTimeout(timeout);
+            }
+
+            int read(void* data, size_t size) override
+            {
+                return master_.read(data, size);
+            }
+
+            int write(void const* data, size_t size) override
+            {
+                if (getOpcode(static_cast<char const*>(data), size) != opcode::DATA)
+                {
+                    return master_.write(data, size);
+                }
+                if (position_ != nullptr)
+                {
+                    int64_t block = *position_;
+                    if (block != previous_ + 1)
+                    {
+                        stream_.multicast.position = block;
+                        group_.write(forgeOptionAck(stream_));
+                    }
+                    previous_ = block;
+                }
+                return group_.write(data, size);
+            }
+
+            using AbstractSocket::read;
+            using AbstractSocket::write;
+
+        private:
+            Socket& group_;
+            AbstractSocket& master_;
+            Request stream_;
+            std::atomic<int64_t> const* position_;  //< null if block numbers do not wrap around
+            int64_t previous_{-1};
+        };
+    }
+
+
+    Server::Server(ServerConfig const& config)
+        : config_{config}
+        , scheduler_{config.global_rate, config.client_rate}
+        , policy_{config.policy, config.memory_budget, config.max_socket_buffer}
+        , metrics_{config.max_sessions}
+    {
+    }
+
+
+    Server::~Server()
+    {
+        stop();
+    }
+
+
+    int Server::start()
+    {
+        if (not policy_.isValid())
+        {
+            return -1;
+        }
+
+        std::vector<int> cpus = config_.cpus;
+        if (cpus.empty())
+        {
+            cpus.push_back(-1);
+        }
+
+        // Shards listen on the same port: the kernel delivers each request to one of them
+        bool reuse_port = (cpus.size() > 1);
+        for (int cpu : cpus)
+        {
+            auto shard = std::make_unique<Shard>();
+            shard->cpu = cpu;
+            if (shard->listener.bind(config_.address, config_.port, reuse_port))
+            {
+                shards_.clear();
+                return -1;
+            }
+
+            // Wake up regularly to check if the server is stopped
+            shard->listener.setTimeout(std::chrono::milliseconds(100));
+            shards_.push_back(std::move(shard));
+        }
+        if (reuse_port and shards_.front()->listener.steerByCpu(cpus))
+        {
+            shards_.clear();
+            return -1;
+        }
+
+        is_running_ = true;
+        for (int i = 0; i < config_.max_sessions; ++i)
+        {
+            workers_.emplace_back(&Server::work, this, std::ref(*shards_[i % shards_.size()]), i);
+        }
+        for (auto& shard : shards_)
+        {
+            shard->listener_thread = std::thread(&Server::listen, this, std::ref(*shard));
+        }
+        return 0;
+    }
+
+
+    void Server::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_running_ = false;
+        }
+        for (auto& shard : shards_)
+        {
+            shard->cv.notify_all();
+        }
+
+        for (auto& shard : shards_)
+        {
+            if (shard->listener_thread.joinable())
+            {
+                shard->listener_thread.join();
+            }
+        }
+        for (auto& worker : workers_)
+        {
+            worker.join();
+        }
+        workers_.clear();
+
+        shards_.clear();
+        pending_sessions_ = 0;
+    }
+
+
+    ServerStats Server::stats() const
+    {
+        ServerStats stats;
+        stats.active_sessions  = active_sessions_;
+        stats.pending_sessions = pending_sessions_;
+        stats.accepted         = accepted_;
+        stats.rejected         = rejected_;
+        stats.duplicates       = duplicates_;
+        stats.invalid          = invalid_;
+        stats.remote_sessions  = remote_sessions_;
+        stats.multicast_joins  = multicast_joins_;
+        stats.reserved_memory  = policy_.reserved();
+        stats.shrunk_windows   = policy_.shrunk();
+        return stats;
+    }
+
+
+    Counters Server::metrics() const
+    {
+        return metrics_.totals();
+    }
+
+
+    std::string Server::prometheus() const
+    {
+        ServerStats current = stats();
+
+        std::string text;
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "# HELP tftp_active_sessions Transfers running\n"
+                 "# TYPE tftp_active_sessions gauge\n"
+                 "tftp_active_sessions %" PRId64 "\n"
+                 "# HELP tftp_pending_sessions Requests waiting for a worker\n"
+                 "# TYPE tftp_pending_sessions gauge\n"
+                 "tftp_pending_sessions %" PRId64 "\n"
+                 "# HELP tftp_requests_total Requests received by outcome\n"
+                 "# TYPE tftp_requests_total counter\n"
+                 "tftp_requests_total{outcome=\"accepted\"} %" PRIu64 "\n"
+                 "tftp_requests_total{outcome=\"rejected\"} %" PRIu64 "\n"
+                 "tftp_requests_total{outcome=\"duplicate\"} %" PRIu64 "\n"
+                 "tftp_requests_total{outcome=\"invalid\"} %" PRIu64 "\n",
+                 current.active_sessions, current.pending_sessions,
+                 current.accepted, current.rejected, current.duplicates, current.invalid);
+        text += line;
+        text += toPrometheus(metrics());
+        return text;
+    }
+
+
+    void Server::listen(Shard& shard)
+    {
+        if ((shard.cpu >= 0) and (pinThread(shard.cpu) != 0))
+        {
+            TFTP_LOG(WARNING, "Cannot pin the listener on CPU %d\n", shard.cpu);
+        }
+
+        Socket& listener = shard.listener;
+        char request_buffer[512];
+        while (is_running_)
+        {
+            int rec = listener.read(request_buffer, sizeof(request_buffer));
+            if (rec < 0)
+            {
+                continue;
+            }
+            auto received = std::chrono::steady_clock::now();
+
+            Request request;
+            if (parseRequest(request_buffer, rec, request) != 0)
+            {
+                ++invalid_;
+                listener.switchToLast();
+                listener.write(forgeError(error_code::ILLEGAL_OPERATION));
+                continue;
+            }
+
+            std::string tid = listener.lastTid();
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (tids_.count(tid) != 0)
+            {
+                // Client retransmitted its request: the session is already pending or running
+                ++duplicates_;
+                continue;
+            }
+
+            if (pending_sessions_ >= config_.max_pending)
+            {
+                // Overloaded: shed the request now instead of letting the client time out
+                lock.unlock();
+                ++rejected_;
+                listener.switchToLast();
+                listener.write(forgeError(error_code::SERVER_BUSY));
+                continue;
+            }
+
+            std::vector<char> datagram;
+            if (config_.record_directory != nullptr)
+            {
+                datagram.assign(request_buffer, request_buffer + rec);
+            }
+
+            tids_.insert(tid);
+            shard.pending.push_back({request, listener.createSocket(), tid, received, std::move(datagram)});
+            ++pending_sessions_;
+            ++accepted_;
+            lock.unlock();
+            shard.cv.notify_one();
+        }
+    }
+
+
+    void Server::work(Shard& shard, int index)
+    {
+        // Session buffers are allocated by this thread: pinning first makes them local to the NUMA node
+        if ((shard.cpu >= 0) and (pinThread(shard.cpu) != 0))
+        {
+            TFTP_LOG(WARNING, "Cannot pin worker %d on CPU %d\n", index, shard.cpu);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            shard.cv.wait(lock, [&]() { return (not shard.pending.empty()) or (not is_running_); });
+            if (not is_running_)
+            {
+                return;
+            }
+
+            PendingSession session = std::move(shard.pending.front());
+            shard.pending.pop_front();
+            --pending_sessions_;
+            ++active_sessions_;
+            lock.unlock();
+
+            if (serve(session, metrics_.shard(index)))
+            {
+                // Taken over by a multicast stream (TID released on join)
+                lock.lock();
+                --active_sessions_;
+                continue;
+            }
+            int cpu = session.socket.incomingCpu();
+            if ((shard.cpu >= 0) and (cpu >= 0) and (cpu != shard.cpu))
+            {
+                ++remote_sessions_;
+            }
+
+            lock.lock();
+            tids_.erase(session.tid);
+            --active_sessions_;
+        }
+    }
+
+
+    bool Server::serve(PendingSession& pending, MetricsShard& shard)
+    {
+        Request& request = pending.request;
+        Socket& transferSocket = pending.socket;
+
+        TFTP_LOG(INFO, "opcode      : %x\n", request.operation);
+        TFTP_LOG(INFO, "mode        : %s\n", toString(request.mode));
+        TFTP_LOG(INFO, "filename    : %s\n", request.filename.c_str());
+        for (auto const& option : request.supportedOptions())
+        {
+            TFTP_LOG(INFO, "%-12s: %-4ld (%d)\n", option->name, option->value, option->is_enable);
+        }
+
+        Scheduler::Flow flow(scheduler_, transferSocket.targetAddress());
+        SessionMetrics metrics(&shard);
+        Session session;
+        session.flow = &flow;
+        session.metrics = &metrics;
+        Digest digest(config_.digest);
+        if (config_.digest != DigestType::NONE)
+        {
+            session.digest = &digest;
+        }
+        metrics.add(SESSIONS);
+#ifdef TFTP_TRACING
+        Tracer tracer(config_.trace_directory != nullptr);
+        session.tracer = &tracer;
+#endif
+        // Packets of the session, to replay it against another build (tftp_replay)
+        std::ofstream recording;
+        std::unique_ptr<RecordingSocket> recorder;
+        AbstractSocket* socket = &transferSocket;
+        if (config_.record_directory != nullptr)
+        {
+            std::string path = std::string(config_.record_directory) + "/session-" + std::to_string(++recordings_) + ".tftprec";
+            recording.open(path, std::ofstream::binary);
+            if (recording)
+            {
+                // Timestamps start at the reception of the request: the replay also waits for the queue time
+                recorder = std::make_unique<RecordingSocket>(transferSocket, recording, pending.received);
+                recorder->recordRequest(pending.datagram);
+                socket = recorder.get();
+                TFTP_LOG(INFO, "-> recording: %s\n", path.c_str());
+            }
+            else
+            {
+                TFTP_LOG(WARNING, "Cannot open the recording %s\n", path.c_str());
+            }
+        }
+
+        if (request.block_size.is_enable)
+        {
+            // Never negotiate a block size that would be fragmented on the path to the client
+            int64_t max_block_size = maxBlockSize(transferSocket.maxDatagramPayload());
+            request.block_size.value = std::min(request.block_size.value, max_block_size);
+        }
+
+        // Limits of the client subnet and file class, the socket buffers are taken from the memory budget
+        OptionPolicy::Grant grant(policy_, transferSocket.targetAddress(), request);
+
+        transferSocket.setTimeout(std::chrono::seconds(request.timeout.value));
+        if (config_.busy_poll.count() > 0)
+        {
+            transferSocket.setBusyPoll(config_.busy_poll);
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+
+        int ret = 0;
+        std::fstream file;
+
+        transferSocket.setBufferSize(request.window_size.value * (request.block_size.value + 4),
+                                     config_.max_socket_buffer, config_.force_socket_buffer);
+
+        if ((request.operation != opcode::RRQ) or (config_.multicast_address == nullptr))
+        {
+            request.multicast.is_enable = false; // not negotiated
+        }
+
+        if (request.operation == opcode::WRQ)
+        {
+            if (request.transfer_size.is_enable)
+            {
+                // Reject the upload before touching the file if it cannot fit
+                ret = checkFreeSpace(request.filename.c_str(), request.transfer_size.value);
+                if (ret < 0)
+                {
+                    socket->write(forgeError(error_code(-ret)));
+                    metrics.add(FAILED_SESSIONS);
+                    return false;
+                }
+            }
+
+            // The direct sink also handles the durability of buffered uploads (fdatasync)
+            DirectFileBuf direct_file;
+            std::ostream direct_stream(&direct_file);
+            bool use_sink = config_.direct_io or (config_.durability != Durability::NONE);
+            if (use_sink)
+            {
+                ret = direct_file.open(request.filename.c_str(), config_.direct_io, config_.durability, config_.sync_interval);
+                if (ret < 0)
+                {
+                    socket->write(forgeError(error_code(-ret)));
+                    metrics.add(FAILED_SESSIONS);
+                    return false;
+                }
+            }
+            else
+            {
+                file.open(request.filename, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+            }
+
+            if (request.transfer_size.is_enable)
+            {
+                ret = preallocate(request.filename.c_str(), request.transfer_size.value);
+                if (ret < 0)
+                {
+                    socket->write(forgeError(error_code(-ret)));
+                    metrics.add(FAILED_SESSIONS);
+                    return false;
+                }
+            }
+
+            std::vector<char> reply = forgeOptionAck(request);
+            if (reply.size() == 0)
+            {
+                reply = forgeAck(0);
+            }
+            socket->write(reply);
+            if (use_sink)
+            {
+                ret = processWrite(request, *socket, direct_stream, session);
+                direct_file.close();
+            }
+            else
+            {
+                ret = processWrite(request, *socket, file, session);
+            }
+        }
+        else
+        {
+            if (request.transfer_size.is_enable)
+            {
+                // Report the file size in the OACK
+                request.transfer_size.value = fileSize(request.filename.c_str());
+                if (request.transfer_size.value < 0)
+                {
+                    socket->write(forgeError(error_code::FILE_NOT_FOUND));
+                    metrics.add(FAILED_SESSIONS);
+                    return false;
+                }
+            }
+
+            if (request.multicast.is_enable and joinStream(pending))
+            {
+                return true; // served by the stream of another client
+            }
+
+            file.open(request.filename, std::fstream::in | std::fstream::binary);
+            if (request.multicast.is_enable)
+            {
+                ret = runStream(pending, *socket, file, session);
+            }
+            else
+            {
+                std::vector<char> reply = forgeOptionAck(request);
+                if (reply.size() != 0)
+                {
+                    // send OACK
+                    socket->write(reply);
+
+                    // wait for OACK ack (0)
+                    char ack[4];
+                    int rec = socket->read(ack, 4);
+                    if ((rec < 0) or (parseAck(ack, rec) != 0))
+                    {
+                        TFTP_LOG(WARNING, "Oops\n");
+                        metrics.add(FAILED_SESSIONS);
+                        return false; // Abort transfer
+                    }
+                }
+                ret = processRead(request, *socket, file, session);
+            }
+        }
+        if (ret < 0)
+        {
+            metrics.add(FAILED_SESSIONS);
+        }
+        if (config_.on_transfer)
+        {
+            config_.on_transfer(TransferReport{static_cast<opcode>(request.operation), request.filename, ret,
+                                             session.is_multicast ? std::string() : digest.hex()});
+        }
+
+        double file_size = fileSize(request.filename.c_str()) / 1024.0 / 1024.0;
+        file.close();
+
+        auto end = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0;
+        TFTP_LOG(INFO, "Transfer %fMB in %fs\n", file_size, elapsed);
+        TFTP_LOG(INFO, "-> %fMB/s\n", file_size / elapsed);
+        TFTP_LOG(INFO, "-> retransmits: %" PRIu64 " timeouts: %" PRIu64 " dropped: %" PRIu64 " srtt: %ldus window: %.1f\n",
+               metrics[RETRANSMITS], metrics[TIMEOUTS], metrics[DROPPED], metrics.srtt().count(), metrics.window());
+        if (session.digest != nullptr)
+        {
+            TFTP_LOG(INFO, "-> %s: %s\n", toString(config_.digest), digest.hex().c_str());
+        }
+#ifdef TFTP_TRACING
+        std::string summary = tracer.summary();
+        for (std::size_t line_begin = 0, line_end; line_begin < summary.size(); line_begin = line_end + 1)
+        {
+            line_end = summary.find('\n', line_begin);
+            TFTP_LOG(INFO, "%.*s\n", static_cast<int>(line_end - line_begin), summary.data() + line_begin);
+        }
+        if (config_.trace_directory != nullptr)
+        {
+            std::string path = std::string(config_.trace_directory) + "/session-" + std::to_string(++traces_) + ".json";
+            std::ofstream trace(path);
+            tracer.writeChromeTrace(trace);
+            TFTP_LOG(INFO, "-> trace: %s\n", path.c_str());
+        }
+#endif
+        return false;
+    }
+
+
+    bool Server::joinStream(PendingSession& pending)
+    {
+        Request& request = pending.request;
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto stream = streams_.find(request.filename);
+        if (stream != streams_.end())
+        {
+            // A listener shall accept the options of the stream: it may become its master
+            Request const& options = stream->second->request;
+            int64_t block_size  = request.block_size.is_enable  ? request.block_size.value  : BLKSIZE.default_value;
+            int64_t window_size = request.window_size.is_enable ? request.window_size.value : WINDOWSIZE.default_value;
+            if ((block_size < options.block_size.value) or (window_size < options.window_size.value))
+            {
+                request.multicast.is_enable = false; // served on its own
+                return false;
+            }
+
+            request.block_size.value  = options.block_size.value;
+            request.window_size.value = options.window_size.value;
+            request.multicast = options.multicast;
+            request.multicast.is_master = false;
+            if (stream->second->last_block > UINT16_MAX)
+            {
+                request.multicast.position = stream->second->position + 1; // where it starts listening
+            }
+            pending.socket.write(forgeOptionAck(request));
+
+            // The stream owns the session from now on: the worker is released
+            tids_.erase(pending.tid);
+            stream->second->listeners.push_back(std::move(pending));
+            ++multicast_joins_;
+            return true;
+        }
+
+        // Open a stream on a port not used by another one, this client is its first master
+        int port = config_.multicast_port;
+        for (auto const& other : streams_)
+        {
+            port = std::max(port, other.second->request.multicast.port + 1);
+        }
+        request.multicast.address = config_.multicast_address;
+        request.multicast.port = port;
+        request.multicast.is_master = true;
+        int64_t last_block = fileSize(request.filename.c_str()) / request.block_size.value + 1;
+        streams_[request.filename] = std::make_unique<MulticastStream>(request, last_block);
+        return false;
+    }
+
+
+    int Server::runStream(PendingSession& first, AbstractSocket& socket, std::istream& file, Session& session)
+    {
+        std::string filename = first.request.filename;
+        MulticastStream* stream;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream = streams_[filename].get();
+        }
+        int64_t last_block = stream->last_block;
+        std::atomic<int64_t> const* positions = (last_block > UINT16_MAX) ? &stream->position : nullptr;
+
+        Socket group(first.request.multicast.address.c_str(), first.request.multicast.port);
+        session.is_multicast = true;
+        session.stream_position = &stream->position;
+        session.digest = nullptr; // each master resumes the stream at its own first missing block
+
+        // Designate the master: it answers the OACK with the ACK of the block before its first missing one (the
+        // last block if it already has the whole file), then the stream goes on from there until it has the file
+        auto serveMaster = [&](Request& request, AbstractSocket& master) -> int
+        {
+            request.multicast.is_master = true;
+            std::vector<char> reply = forgeOptionAck(request);
+            char ack[4];
+            int rec = -1;
+            for (int retry = 0; (retry < 3) and (rec < 0); ++retry)
+            {
+                master.write(reply);
+                rec = master.read(ack, 4);
+            }
+            int ack_block = (rec < 0) ? -1 : parseAck(ack, rec);
+            if (ack_block < 0)
+            {
+                return -error_code::RETRY_EXCEEDED;
+            }
+
+            if (ack_block == static_cast<uint16_t>(last_block))
+            {
+                return 0; // a client only ACKs the last block number once it has the whole file
+            }
+
+            // Block numbers wrap around: the stream resumes at the lowest block the ACK may stand for, the master
+            // ACKs ahead from there up to its first missing block. A listener that lost the position sent to the
+            // group must not take the first block for the one following the previous run: the master's last block
+            // is resent first.
+            int64_t acked = ack_block;
+
+            session.first_block = acked + 1;
+            int64_t following = stream->position + 1;
+            if ((positions != nullptr) and (acked > 0) and (session.first_block != following)
+                and (static_cast<uint16_t>(session.first_block) == static_cast<uint16_t>(following)))
+            {
+                session.first_block = acked;
+            }
+            MulticastSocket multicast(group, master, request, positions);
+            return processRead(request, multicast, file, session);
+        };
+
+        int ret = serveMaster(first.request, socket);
+        while (true)
+        {
+            std::unique_ptr<PendingSession> next;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stream->listeners.empty())
+                {
+                    streams_.erase(filename);
+                    return ret;
+                }
+                next = std::make_unique<PendingSession>(std::move(stream->listeners.front()));
+                stream->listeners.pop_front();
+            }
+
+            // A listener that got the whole file already reported it: an OACK to its closed port would only
+            // bounce, and hide the ACK queued behind the error
+            Socket& listener = next->socket;
+            char ack[4];
+            int result = 0;
+            bool is_done = (Socket::waitReadable({&listener}, std::chrono::milliseconds(0)) == 0)
+                       and (listener.read(ack, sizeof(ack)) == sizeof(ack))
+                       and (parseAck(ack, sizeof(ack)) == static_cast<uint16_t>(last_block));
+            if (not is_done)
+            {
+                result = serveMaster(next->request, listener);
+            }
+            if (result < 0)
+            {
+                session.count(FAILED_SESSIONS);
+            }
+            if (config_.on_transfer)
+            {
+                config_.on_transfer(TransferReport{opcode::RRQ, filename, result, {}});
+            }
+        }
+    }
+}
@@ -0,0 +1,186 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace tftp
+{
+    namespace
+    {
+        thread_local Tracer* current_tracer = nullptr;
+    }
+
+
+    int Histogram::indexOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return static_cast<int>(value);
+        }
+
+        int exponent = 63 - __builtin_clzll(value);
+        int shift = exponent - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) - SUB_BUCKETS);
+    }
+
+
+    uint64_t Histogram::upperBoundOf(int index)
+    {
+        if (index < SUB_BUCKETS)
+        {
+            return index;
+        }
+
+        int shift = index / SUB_BUCKETS - 1;
+        uint64_t sub_bucket = SUB_BUCKETS + index % SUB_BUCKETS;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+
+    void Histogram::record(uint64_t value)
+    {
+        ++counts_[indexOf(value)];
+        ++count_;
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+
+    void Histogram::merge(Histogram const& other)
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+
+    uint64_t Histogram::percentile(double percent) const
+    {
+        if (count_ == 0)
+        {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(percent / 100.0 * count_);
+        rank = std::max<uint64_t>(1, std::min(rank, count_));
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            seen += counts_[i];
+            if (seen >= rank)
+            {
+                return std::min(upperBoundOf(i), max_);
+            }
+        }
+        return max_;
+    }
+
+
+    char const* toString(Stage stage)
+    {
+        switch (stage)
+        {
+            case FILE_READ:     { return "file read";   }
+            case FORGE:         { return "forge";       }
+            case PACING:        { return "pacing";      }
+            case SEND:          { return "send";        }
+            case RECEIVE:       { return "receive";     }
+            case WAIT_ACK:      { return "wait ack";    }
+            case FILE_WRITE:    { return "file write";  }
+            case DIGEST:        { return "digest";      }
+            default:            { return "unknown";     }
+        }
+    }
+
+
+    Tracer::Tracer(bool record_events, std::size_t max_events)
+        : origin_{clock::now()}
+        , record_events_{record_events}
+        , max_events_{max_events}
+    {
+    }
+
+
+    void Tracer::add(Stage stage, clock::time_point begin, clock::time_point end)
+    {
+        auto duration = end - begin;
+        histograms_[stage].record(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+
+        if (record_events_)
+        {
+            if (events_.size() < max_events_)
+            {
+                events_.push_back({stage, begin, duration});
+            }
+            else
+            {
+                ++dropped_events_;
+            }
+        }
+    }
+
+
+    std::string Tracer::summary() const
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "%-12s %10s %12s %10s %10s %10s %10s\n",
+                 "stage", "count", "total (ms)", "p50 (us)", "p99 (us)", "p99.9 (us)", "max (us)");
+        std::string text = line;
+        for (int i = 0; i < STAGE_COUNT; ++i)
+        {
+            Histogram const& h = histograms_[i];
+            if (h.count() == 0)
+            {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%-12s %10" PRIu64 " %12.3f %10.1f %10.1f %10.1f %10.1f\n",
+                     toString(Stage(i)), h.count(), h.sum() / 1e6,
+                     h.percentile(50) / 1e3, h.percentile(99) / 1e3, h.percentile(99.9) / 1e3, h.max() / 1e3);
+            text += line;
+        }
+        return text;
+    }
+
+
+    void Tracer::writeChromeTrace(std::ostream& output, int pid, int tid) const
+    {
+        char line[256];
+        output << "{\"traceEvents\":[\n";
+        for (std::size_t i = 0; i < events_.size(); ++i)
+        {
+            Event const& event = events_[i];
+            double ts = std::chrono::duration<double, std::micro>(event.begin - origin_).count();
+            double dur = std::chrono::duration<double, std::micro>(event.duration).count();
+            snprintf(line, sizeof(line),
+                     "{\"name\":\"%s\",\"cat\":\"tftp\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}%s\n",
+                     toString(event.stage), ts, dur, pid, tid, (i + 1 < events_.size()) ? "," : "");
+            output << line;
+        }
+        output << "],\"displayTimeUnit\":\"ns\"}\n";
+    }
+
+
+    Tracer* Tracer::current()
+    {
+        return current_tracer;
+    }
+
+
+    TraceContext::TraceContext(Tracer* tracer)
+        : previous_{current_tracer}
+    {
+        current_tracer = tracer;
+    }
+
+
+    TraceContext::~TraceContext()
+    {
+        current_tracer = previous_;
+    }
+}